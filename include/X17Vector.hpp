@@ -11,6 +11,9 @@
 #include <algorithm>
 #include <cstdbool>
 #include <vector>
+#include <new>
+#include <memory>
+#include <type_traits>
 
 ////////////////////////////////////////////////////////////
 
@@ -35,6 +38,33 @@ namespace X17 {
 static const int8_t* POISON_PTR = reinterpret_cast<const int8_t*>(0xDEADDEAD);
 static const uint64_t POISON_UINT = static_cast<uint64_t>(0xDEADBEEF);
 
+////////////////////////////////////////////////////////////////////////
+/// ALLOCATOR TRAITS
+////////////////////////////////////////////////////////////////////////
+
+// allocators able to grow a block in place (e.g. X17::GenericAllocator)
+// provide bool try_expand(pointer, size_type old_cnt, size_type new_cnt)
+template <typename Allocator, typename = void>
+struct has_try_expand : std::false_type {};
+
+template <typename Allocator>
+struct has_try_expand<
+    Allocator,
+    std::void_t<decltype(std::declval<Allocator&>().try_expand(
+        std::declval<typename Allocator::value_type*>(), std::size_t(),
+        std::size_t()))>> : std::true_type {};
+
+// allocators able to hand out over-aligned blocks provide
+// pointer allocate_aligned(size_type cnt, size_type alignment)
+template <typename Allocator, typename = void>
+struct has_allocate_aligned : std::false_type {};
+
+template <typename Allocator>
+struct has_allocate_aligned<
+    Allocator,
+    std::void_t<decltype(std::declval<Allocator&>().allocate_aligned(
+        std::size_t(), std::size_t()))>> : std::true_type {};
+
 template <typename T, template<typename> class Alloc = std::allocator>
 class vector {
    public:
@@ -289,14 +319,17 @@ class vector {
     };
 
    public:
-    explicit vector();
+    // a stateful allocator (e.g. std::pmr::polymorphic_allocator over a
+    // resource chosen at runtime) is passed in, a stateless one defaults
+    explicit vector(const Alloc<T>& allocator = Alloc<T>());
 
-    explicit vector(const uint64_t elem_total, T&& init_value = T());
+    explicit vector(const uint64_t elem_total, T&& init_value = T(),
+                    const Alloc<T>& allocator = Alloc<T>());
 
-    explicit vector(const vector<T>& other);
+    explicit vector(const vector& other);
 
     // move constructor
-    explicit vector(vector<T>&& other);
+    explicit vector(vector&& other);
 
     ~vector();
 
@@ -324,6 +357,9 @@ class vector {
         return const_iterator(__data_ptr() + m_size);
     }      
 
+   public:
+    Alloc<T> get_allocator() const { return m_allocator; }
+
    public:
     uint64_t size() const { return m_size; }
     bool empty() const { return m_size == 0; }
@@ -405,16 +441,26 @@ class vector {
                           uint64_t required,
                           const T& value = T());
 
+    int8_t* __alloc_mem(uint64_t elem_total);
+
+    void __free_mem(int8_t* memory, uint64_t elem_total);
+
    private:
     uint64_t m_size;
     uint64_t m_capacity;
     uint64_t m_typesize;
     int8_t* m_data;
 
+    Alloc<T> m_allocator;
+
    private:
     /* CONSTANTS */
     static const uint32_t DEFAULT_CAPACITY = 16;
 
+    // buffers of arithmetic types start on a cache line (SIMD loads, no
+    // false sharing with a neighbouring block)
+    static const uint32_t CACHE_LINE_SIZE = 64;
+
     // TODO: make use of load factor (unused rn)
     constexpr static double DEFAULT_LOAD_FACTOR = 1.0;
     constexpr static double DEFAULT_GROWTH_FACTOR = 1.618; /* golden ratio */
@@ -773,40 +819,51 @@ class vector<bool> {
 ////////////////////////////////////////////////////////////////////////
 
 template <typename T, template<typename> class Alloc>
-vector<T, Alloc>::vector()
-    : m_capacity(DEFAULT_CAPACITY), m_size(0), m_typesize(sizeof(T)) {
+vector<T, Alloc>::vector(const Alloc<T>& allocator)
+    : m_capacity(DEFAULT_CAPACITY),
+      m_size(0),
+      m_typesize(sizeof(T)),
+      m_allocator(allocator) {
     vector_log();
 
-    m_data = new int8_t[m_capacity * m_typesize];
+    m_data = __alloc_mem(m_capacity);
 }
 
 template <typename T, template<typename> class Alloc>
-vector<T, Alloc>::vector(const uint64_t elem_total, T&& init_value)
-    : m_capacity(elem_total), m_size(0), m_typesize(sizeof(T)) {
+vector<T, Alloc>::vector(const uint64_t elem_total, T&& init_value,
+                         const Alloc<T>& allocator)
+    : m_capacity(elem_total),
+      m_size(0),
+      m_typesize(sizeof(T)),
+      m_allocator(allocator) {
     vector_log();
 
-    m_data = new int8_t[m_capacity * m_typesize];
+    m_data = __alloc_mem(m_capacity);
     __obj_init(__data_ptr(), 0, elem_total, std::move(init_value));
 }
 
 template <typename T, template<typename> class Alloc>
-vector<T, Alloc>::vector(const vector<T>& other)
+vector<T, Alloc>::vector(const vector& other)
     : m_capacity(other.m_capacity),
       m_size(other.m_size),
-      m_typesize(other.m_typesize) {
+      m_typesize(other.m_typesize),
+      m_allocator(std::allocator_traits<Alloc<T>>::select_on_container_copy_construction(
+          other.m_allocator)) {
     vector_log();
 
-    m_data = new int8_t[m_capacity * m_typesize];
+    m_data = __alloc_mem(m_capacity);
     // other.__data_ptr() returns const T*
     __obj_init(__data_ptr(), 0, m_size, other.__data_ptr());
 }
 
 template <typename T, template<typename> class Alloc>
-vector<T, Alloc>::vector(vector<T>&& other)
+vector<T, Alloc>::vector(vector&& other)
     : m_capacity(other.m_capacity),
       m_size(other.m_size),
       m_data(nullptr),
-      m_typesize(other.m_typesize) {
+      m_typesize(other.m_typesize),
+      // the stolen buffer is freed by the allocator it came from
+      m_allocator(other.m_allocator) {
     vector_log();
 
     // ONLY swapping pointers, stealing it, no copying!
@@ -820,8 +877,8 @@ vector<T, Alloc>::~vector() {
     if (m_data != nullptr) {
         __del_obj(reinterpret_cast<T*>(m_data), 0, m_size);
 
-        // WARNING: don't forget to delete[] and avoid memory leaks
-        delete[] m_data;
+        // WARNING: don't forget to free and avoid memory leaks
+        __free_mem(m_data, m_capacity);
     }
 
     // fill everything with poison!
@@ -871,7 +928,8 @@ void vector<T, Alloc>::push_back(const T& value) {
     vector_log();
 
     reserve((m_capacity == 0 ? DEFAULT_CAPACITY : m_size + 1));
-    __data_ptr()[m_size++] = value;
+    // memory past m_size is raw, construct instead of assigning
+    new (__data_ptr() + m_size++) T(value);
 }
 
 template <typename T, template<typename> class Alloc>
@@ -879,7 +937,7 @@ void vector<T, Alloc>::push_back(T&& value) {
     vector_log();
 
     reserve((m_capacity == 0 ? DEFAULT_CAPACITY : m_size + 1));
-    __data_ptr()[m_size++] = std::forward<T>(value);
+    new (__data_ptr() + m_size++) T(std::forward<T>(value));
 }
 
 template <typename T, template<typename> class Alloc>
@@ -897,7 +955,7 @@ template <typename T, template<typename> class Alloc>
 void vector<T, Alloc>::reserve(uint64_t size) {
     vector_log();
 
-    if (size < m_size) {
+    if (size <= m_capacity) {
         // ignore, more than enough space already
         return;
     }
@@ -1061,18 +1119,46 @@ int8_t* vector<T, Alloc>::__realloc_mem(T* current_data,
                                  uint64_t current_size,
                                  uint64_t required,
                                  const T& value) {
-    int8_t* reallocated_memory = new int8_t[required * m_typesize]();
+    if constexpr (has_try_expand<Alloc<T>>::value) {
+        // elements stay where they are, nothing to move
+        if (current_data != nullptr &&
+            m_allocator.try_expand(current_data, m_capacity, required)) {
+            return reinterpret_cast<int8_t*>(current_data);
+        }
+    }
+
+    int8_t* reallocated_memory = __alloc_mem(required);
     T* new_data = reinterpret_cast<T*>(reallocated_memory);
 
     __mv_obj_init(new_data, 0, current_size, current_data);
     __del_obj(current_data, 0, current_size);
 
-    // IMPORTANT: don't forget to DELETE
-    delete[] reinterpret_cast<int8_t*>(current_data);
+    // IMPORTANT: don't forget to free
+    __free_mem(reinterpret_cast<int8_t*>(current_data), m_capacity);
 
     return reallocated_memory;
 }
 
+template <typename T, template<typename> class Alloc>
+int8_t* vector<T, Alloc>::__alloc_mem(uint64_t elem_total) {
+    if constexpr (std::is_arithmetic<T>::value &&
+                  has_allocate_aligned<Alloc<T>>::value) {
+        return reinterpret_cast<int8_t*>(
+            m_allocator.allocate_aligned(elem_total, CACHE_LINE_SIZE));
+    }
+
+    return reinterpret_cast<int8_t*>(m_allocator.allocate(elem_total));
+}
+
+template <typename T, template<typename> class Alloc>
+void vector<T, Alloc>::__free_mem(int8_t* memory, uint64_t elem_total) {
+    if (memory == nullptr) {
+        return;
+    }
+
+    m_allocator.deallocate(reinterpret_cast<T*>(memory), elem_total);
+}
+
 }  // namespace X17
 
 #endif  // !X17_VECTOR_HPP
\ No newline at end of file
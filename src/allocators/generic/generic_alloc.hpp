@@ -5,381 +5,2675 @@
 /// Headers
 ////////////////////////////////////////////////////////////
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <execinfo.h>
+#include <ctime>
+#include <cstddef>
 #include <cstdint>
 #include <utility>
 #include <new>
 #include <stdexcept>
-#include <list>
+#include <cstdio>
+#include <algorithm>
+#include <cstring>
+#include <atomic>
+#include <memory_resource>
 
 #ifndef ALLOC_NOEXCEPT
 #define ALLOC_NOEXCEPT
 #endif
 
+/* define ALLOC_THREAD_SAFE to make the heap usable from several threads */
+#ifdef ALLOC_THREAD_SAFE
+#include <mutex>
+#endif  // ALLOC_THREAD_SAFE
+
 namespace X17 {
 
 using data_t = intptr_t;
 
-/* allocates N bytes (N >= n_bytes) */
-data_t* allocate(const size_t n_bytes) {
-    if (n_bytes == 0) {
-        return nullptr;
-    }
+static const size_t SPLIT_RATE_MIN_BYTES = 16;
 
-    size_t n_aligned_bytes = std::max(alignBytes(n_bytes), MIN_ALLOC_SIZE);
+// address space reserved by a local Heap unless it is told otherwise
+static const size_t DEFAULT_HEAP_REGION = 256 * 1024 * 1024;
+
+// allocations of at least MMAP_THRESHOLD bytes get a mapping of their own
+static const size_t MMAP_THRESHOLD = 128 * 1024;
+// a free chunk this large at the top of the heap is given back with brk
+static const size_t TRIM_THRESHOLD = 128 * 1024;
+// free chunks this large get their interior pages released with madvise
+static const size_t RELEASE_THRESHOLD = 64 * 1024;
+
+
+// free_list_search bins: exact FREE_LIST_STEP classes below 2^FREE_LIST_SMALL_LOG
+// bytes, 2^FREE_LIST_SPLITS_LOG bins per power of two above
+static const size_t FREE_LIST_STEP = 16;
+static const size_t FREE_LIST_SMALL_LOG = 8;
+static const size_t FREE_LIST_SPLITS_LOG = 2;
+static const size_t FREE_LIST_SMALL_BINS =
+    ((size_t)1 << FREE_LIST_SMALL_LOG) / FREE_LIST_STEP;
+static const size_t FREE_LIST_BINS =
+    FREE_LIST_SMALL_BINS + ((64 - FREE_LIST_SMALL_LOG) << FREE_LIST_SPLITS_LOG);
+static const size_t FREE_LIST_MAP_WORDS = (FREE_LIST_BINS + 63) / 64;
+
+// chunk-size histogram buckets: bucket i counts chunks of [2^i, 2^(i+1)) bytes
+static const size_t HEAP_HISTOGRAM_BUCKETS = 48;
+// sampled allocations kept for call-site attribution (ring buffer)
+static const size_t HEAP_SAMPLES = 256;
+static const size_t HEAP_SAMPLE_FRAMES = 16;
+
+// allocation traces are written through a buffer of TRACE_BUFFER_BYTES
+static const size_t TRACE_BUFFER_BYTES = 64 * 1024;
+// op byte and up to four varints of 10 bytes
+static const size_t TRACE_RECORD_MAX_BYTES = 1 + 4 * 10;
+static const char TRACE_MAGIC[8] = {'X', '1', '7', 'T', 'R', 'A', 'C', 'E'};
 
-    if (Chunk* reused_chunk = getFreeChunk(n_aligned_bytes)) {
-        return reused_chunk->m_data;
-    }
+#ifndef MIN_256_BYTES_ALLOC
+static const size_t MIN_ALLOC_SIZE = 0;
+#else
+static const size_t MIN_ALLOC_SIZE = 256;
+#endif // !MIN_256_BYTES_ALLOC
 
-    Chunk* new_chunk = mapOSmemory(n_bytes);
-    ++TOTAL_CHUNKS_IN_MEMORY;
-    if (new_chunk == nullptr) {
-#ifndef ALLOC_NOEXCEPT
-        throw std::bad_alloc();
-#endif  // ALLOC_NOEXCEPT
+/* define ALLOC_MAX_ALIGN to align every block for any type, as malloc() does */
+#ifndef ALLOC_MAX_ALIGN
+static const size_t CHUNK_ALIGNMENT = sizeof(data_t);
+#else
+static const size_t CHUNK_ALIGNMENT = alignof(std::max_align_t);
+#endif  // !ALLOC_MAX_ALIGN
 
-        return nullptr;
-    }
+#ifdef ALLOC_THREAD_SAFE
+// per-thread caches serve chunks up to THREAD_CACHE_MAX_BYTES by size class
+static const size_t THREAD_CACHE_CLASS_STEP = 16;
+static const size_t THREAD_CACHE_CLASSES = 32;
+static const size_t THREAD_CACHE_MAX_BYTES =
+    THREAD_CACHE_CLASS_STEP * THREAD_CACHE_CLASSES;
 
-    new_chunk->m_used = true;
-    new_chunk->m_prev = nullptr;
-    new_chunk->m_next = nullptr;
-    new_chunk->m_size = n_aligned_bytes;
+// chunks kept per class in a thread cache before a batch goes to the depot
+static const size_t THREAD_CACHE_DEPTH = 64;
+static const size_t THREAD_CACHE_BATCH = 32;
 
-    if (m_heap_head == nullptr) {
-        m_heap_head = new_chunk;
-    }
+// chunks kept per class in the shared depot before the rest goes to the heap
+static const size_t DEPOT_DEPTH = 1024;
 
-    if (m_heap_tail != nullptr) {
-        m_heap_tail->m_next = new_chunk;
-        new_chunk->m_prev = m_heap_tail;
-        new_chunk->m_next = m_heap_head;
-    }
+struct ThreadCache;
+#endif  // ALLOC_THREAD_SAFE
 
-    m_heap_tail = new_chunk;
+enum class MemoryManagement {
+    first_fit_search,
+    next_fit_search,
+    free_list_search,
+    best_fit_search,
+};
 
-    return new_chunk->m_data;
-}
+static const size_t MEMORY_MANAGEMENT_MODES = 4;
 
-void deallocate(const data_t* data_ptr) {
-    if (data_ptr == nullptr) {
-        return;
-    }
+struct HeapStats {
+    /* maintained on every heap call */
+    size_t m_bytes_live;    // payload of used heap chunks (cached ones too)
+    size_t m_bytes_mapped;  // payload of large mmap chunks
+    size_t m_bytes_peak;    // peak of m_bytes_live + m_bytes_mapped
+    size_t m_bytes_heap;    // memory below the break taken by the heap
+    size_t m_bytes_heap_peak;
 
-    Chunk* user_chunk = shiftToHeader(data_ptr);
+    // chunks visited by the search of each MemoryManagement mode
+    size_t m_searches[MEMORY_MANAGEMENT_MODES];
+    size_t m_search_steps[MEMORY_MANAGEMENT_MODES];
 
-    if (isCoalesceablePrev(user_chunk)) {
-        user_chunk = user_chunk->m_prev;
-        user_chunk = coalesceChunk(user_chunk);
-    }
-    if (isCoalesceableNext(user_chunk)) {
-        user_chunk = coalesceChunk(user_chunk);
-    }
+    /* filled by heapStats() with a heap walk */
+    size_t m_bytes_free;
+    size_t m_chunks_used;
+    size_t m_chunks_free;
+    size_t m_largest_free;
 
-    user_chunk->m_used = false;
-}
+    // 1 - largest free chunk / all free bytes
+    double m_fragmentation;
 
-//TODO: stack allocator, local heap implementations
+    size_t m_used_histogram[HEAP_HISTOGRAM_BUCKETS];
+    size_t m_free_histogram[HEAP_HISTOGRAM_BUCKETS];
+};
 
-static const size_t SPLIT_RATE_MIN_BYTES = 16;
-static size_t TOTAL_CHUNKS_IN_MEMORY = 0;
+// one sampled allocation with the call stack that made it
+struct AllocationSample {
+    const data_t* m_data;
+    size_t m_size;
 
+    int m_depth;
+    void* m_frames[HEAP_SAMPLE_FRAMES];
+};
 
-#ifndef MIN_256_BYTES_ALLOC
-static const size_t MIN_ALLOC_SIZE = 0;
-#else
-static const size_t MIN_ALLOC_SIZE = 256;
-#endif // !MIN_256_BYTES_ALLOC
+enum class TraceOp : uint8_t {
+    allocate,
+    deallocate,
+    reallocate,
+    allocate_aligned,
+    try_expand,
+};
 
-enum class MemoryManagement {
-    first_fit_search,
-    next_fit_search,
-    free_list_search,
+/* one recorded call of the program heap. On disk a record is the op byte
+ * followed by varints: timestamp delta, id, size, then the old id
+ * (reallocate) or the alignment (allocate_aligned) */
+struct TraceRecord {
+    TraceOp m_op;
+    uint64_t m_timestamp;  // ns since startTrace()
+
+    // ids are block addresses at record time
+    uint64_t m_id;  // block returned, freed or expanded
+    uint64_t m_size;
+    uint64_t m_old_id;  // reallocate: the block passed in
+    uint64_t m_alignment;
 };
 
 struct Chunk {
     size_t m_size;
 
     bool m_used;
+    // chunk lives in its own mmap region and is never part of the heap list
+    bool m_mapped;
+
+    // boundary tags: a free chunk keeps a copy of m_size in the last word of
+    // its payload, so the chunk after it can find it without any list
+    bool m_prev_used;
+    // the program break (or foreign memory) follows, there is no next chunk
+    bool m_segment_end;
 
     Chunk* m_prev;
     Chunk* m_next;
 
-    data_t m_data[1];
+#ifdef ALLOC_THREAD_SAFE
+    // cache of the thread that allocated the chunk, frees are routed back to it
+    ThreadCache* m_owner;
+#endif  // ALLOC_THREAD_SAFE
+
+    alignas(CHUNK_ALIGNMENT) data_t m_data[1];
 };
 
-static Chunk* m_heap_head;
-static Chunk* m_heap_tail;
+// for the best_fit_search mem-management: free chunks are indexed by a treap
+// ordered by (m_size, address). Nodes live in the free chunks' own payload,
+// so the index never allocates. Node priority is a hash of the chunk address.
+struct SizeIndexNode {
+    Chunk* m_left;
+    Chunk* m_right;
+};
 
-// for the next_fit_search mem-management
-static Chunk* m_last_found;
+// for the free_list_search mem-management: free chunks are threaded through
+// their payload into size bins, each bin in address order
+struct FreeListNode {
+    Chunk* m_prev_free;
+    Chunk* m_next_free;
+};
 
-static std::list<Chunk*> m_free_list;
+/* one heap with its own chunks, free list and search mode. The program heap
+ * behind the free functions grows with the program break, every other heap
+ * grows inside an mmap region of its own and can be dropped at once */
+class Heap {
+    struct ProgramBreak {};
+
+   public:
+    explicit Heap(MemoryManagement search_mode = MemoryManagement::first_fit_search,
+                  const size_t region_bytes = DEFAULT_HEAP_REGION);
+    ~Heap();
+
+    /* HEAPS OWN THEIR CHUNKS, COPY AND MOVE ARE PROHIBITED */
+    Heap(const Heap& other) = delete;
+    Heap(Heap&& other) = delete;
+    Heap& operator=(const Heap& other) = delete;
+    Heap& operator=(Heap&& other) = delete;
+
+    /* the heap used by allocate(), deallocate() etc. */
+    static Heap& programHeap();
+
+   public:
+    data_t* allocate(const size_t n_bytes);
+    void deallocate(const data_t* data_ptr);
+    bool tryExpand(data_t* data_ptr, const size_t n_bytes);
+    data_t* reallocate(data_t* data_ptr, const size_t n_bytes);
+    data_t* allocateAligned(const size_t n_bytes, const size_t alignment);
+
+    /* every chunk of the heap is gone afterwards */
+    void reset();
+    void configure(MemoryManagement search_mode);
+    MemoryManagement mode() const { return m_mem_mode; }
+
+    HeapStats stats();
+    void printStats(FILE* stream);
+    void dump(FILE* stream);
+
+   public:
+    /* internals for the free functions and the thread caches, the caller
+     * holds the heap (m_heap_mutex) */
+    size_t requestSize(const size_t n_bytes) const;
+    size_t alignedRequestSize(const size_t n_bytes) const;
+    size_t alignLeadBytes() const;
+
+    Chunk* heapAllocate(const size_t n_aligned_bytes);
+    Chunk* heapAllocateAligned(const size_t n_aligned_bytes, const size_t alignment);
+    void releaseChunk(Chunk* user_chunk);
+
+    void recordAllocation(const Chunk* user_chunk);
+    void recordLiveBytes(const Chunk* user_chunk, const ptrdiff_t delta);
+
+#ifdef ALLOC_THREAD_SAFE
+    // guards every structure of this heap (chunk list, free list, index)
+    std::mutex m_heap_mutex;
+#endif  // ALLOC_THREAD_SAFE
+
+   private:
+    explicit Heap(ProgramBreak);
+
+    void dropChunks();
+
+    void* currentBreak() const;
+    void* moveBreak(const size_t n_bytes);
+    void lowerBreak(void* new_break);
+
+    size_t minPayloadSize() const;
+    Chunk* mapOSmemory(const size_t n_bytes);
+    bool trimHeapTop(Chunk* cur_chunk);
+
+    Chunk* getFreeChunk(const size_t n_bytes);
+    Chunk* memFirstFit(const size_t n_bytes);
+    Chunk* memNextFit(const size_t n_bytes);
+    Chunk* memFreeList(const size_t n_bytes);
+    Chunk* memBestFit(const size_t n_bytes);
+
+    Chunk* splitChunk(Chunk* cur_chunk, const size_t n_bytes);
+    bool isSplittable(const Chunk* cur_chunk, const size_t n_bytes) const;
+    Chunk* allocateFromList(Chunk* cur_chunk, const size_t n_bytes);
+    Chunk* coalesceChunk(Chunk* cur_chunk);
+    Chunk* extendHeapTop(const size_t n_bytes);
+    bool expandChunk(Chunk* user_chunk, const size_t n_bytes);
+
+    void attachFreeChunk(Chunk* cur_chunk);
+    void detachFreeChunk(Chunk* cur_chunk);
+
+    void indexInsert(Chunk* cur_chunk);
+    void indexRemove(Chunk* cur_chunk);
+
+    void freeListInsert(Chunk* cur_chunk);
+    void freeListRemove(Chunk* cur_chunk);
+    Chunk* freeListFind(const size_t n_bytes);
+    void consolidateFreeChunks();
+
+    void countSearchStep();
+
+   private:
+    Chunk* m_heap_head{nullptr};
+    Chunk* m_heap_tail{nullptr};
+    size_t m_total_chunks{0};
+
+    // for the next_fit_search mem-management
+    Chunk* m_last_found{nullptr};
+
+    // free_list_search bins with a bit per non-empty bin
+    Chunk* m_bin_heads[FREE_LIST_BINS]{};
+    Chunk* m_bin_tails[FREE_LIST_BINS]{};
+    uint64_t m_bin_map[FREE_LIST_MAP_WORDS]{};
+    size_t m_free_list_bytes{0};
+    // frees since the last consolidateFreeChunks()
+    size_t m_deferred_frees{0};
+
+    // root of the best_fit_search size index
+    Chunk* m_size_index_root{nullptr};
+
+    MemoryManagement m_mem_mode{MemoryManagement::first_fit_search};
+
+    // the program heap moves the program break, a local heap moves its own
+    // break inside [m_region_begin, m_region_end)
+    bool m_program_break{false};
+    uint8_t* m_region_begin{nullptr};
+    uint8_t* m_region_end{nullptr};
+    uint8_t* m_region_break{nullptr};
+
+    HeapStats m_heap_stats{};
+    // allocations since the last sample, see setSamplingPeriod()
+    size_t m_sample_count{0};
+};
 
-static MemoryManagement m_mem_mode;  // = MemoryManagement::next_fit_search;
+// every m_sample_period-th allocation of a heap records a backtrace, 0
+// disables it. The sample ring is shared by all heaps. The period is set from
+// any thread while the heaps read it, so it is atomic.
+inline std::atomic<size_t> m_sample_period;
+inline size_t m_samples_taken;
+inline AllocationSample m_samples[HEAP_SAMPLES];
+
+// startTrace() state, records are written with write(2) so tracing never
+// allocates
+inline std::atomic<bool> m_tracing;
+inline int m_trace_fd = -1;
+inline uint64_t m_trace_last;
+inline size_t m_trace_length;
+inline uint8_t m_trace_buffer[TRACE_BUFFER_BYTES];
+
+#ifdef ALLOC_THREAD_SAFE
+// cached chunks stay m_used for the heap and are linked through their payload
+struct ThreadCache {
+    Chunk* m_bins[THREAD_CACHE_CLASSES];
+    size_t m_bin_length[THREAD_CACHE_CLASSES];
+
+    // chunks of this cache freed by other threads, pushed in batches
+    std::atomic<Chunk*> m_remote_frees;
+
+    // outgoing batch of chunks that belong to another cache
+    ThreadCache* m_outbox_owner;
+    Chunk* m_outbox_head;
+    Chunk* m_outbox_tail;
+    size_t m_outbox_length;
+
+    // caches are never freed: a dead cache is adopted by the next new thread
+    std::atomic<bool> m_alive;
+    size_t m_generation;
+    ThreadCache* m_next_cache;
+};
 
-void resetProgramHeap() {
-    if (m_heap_head == nullptr) {
-        return;
-    }
+// shared transfer bins between thread caches, one lock per size class
+struct DepotBin {
+    std::mutex m_mutex;
+    Chunk* m_head;
+    size_t m_length;
+};
 
-    brk(m_heap_head);
+struct ThreadCacheHandle {
+    ThreadCache* m_cache;
 
-    m_heap_head = nullptr;
-    m_heap_tail = nullptr;
-    m_last_found = nullptr;
-}
+    ~ThreadCacheHandle();
+};
 
-void configure(MemoryManagement search_mode) {
-    m_mem_mode = search_mode;
+// guards the sample ring
+inline std::mutex m_samples_mutex;
+// guards the trace buffer
+inline std::mutex m_trace_mutex;
 
-    resetProgramHeap();
-}
+inline DepotBin m_depot[THREAD_CACHE_CLASSES];
 
-inline size_t alignBytes(const size_t n_bytes) {
-    /* sizeof(data_t) = 4 or 8 -> 7 is 111 -> ~7 is 000 -> last 3 bits will be
-     * zeros*/
-    return ~(sizeof(data_t) - 1) & (n_bytes + sizeof(data_t) - 1);
+inline std::mutex m_caches_mutex;
+inline ThreadCache* m_caches;
+
+// bumped by configure(), caches of an older generation are dropped
+inline std::atomic<size_t> m_heap_generation;
+
+inline thread_local ThreadCacheHandle m_thread_cache;
+#endif  // ALLOC_THREAD_SAFE
+
+////////////////////////////////////////////////////////////
+/// Declarations
+////////////////////////////////////////////////////////////
+inline data_t* allocate(const size_t n_bytes);
+inline void deallocate(const data_t* data_ptr);
+inline bool tryExpand(data_t* data_ptr, const size_t n_bytes);
+inline data_t* reallocate(data_t* data_ptr, const size_t n_bytes);
+inline data_t* allocateAligned(const size_t n_bytes, const size_t alignment);
+inline void deallocateAligned(const data_t* data_ptr);
+inline void resetProgramHeap();
+inline void configure(MemoryManagement search_mode);
+
+inline HeapStats heapStats();
+inline void printHeapStats(FILE* stream);
+inline void dumpHeap(FILE* stream);
+inline void setSamplingPeriod(const size_t period);
+inline void dumpSamples(FILE* stream);
+
+inline bool startTrace(const char* path);
+inline void stopTrace();
+inline bool readTraceHeader(FILE* stream);
+inline bool readTraceRecord(FILE* stream, TraceRecord& record);
+
+inline size_t alignBytes(const size_t n_bytes);
+inline size_t allocationSize(const size_t n_bytes);
+inline size_t& chunkFooter(Chunk* cur_chunk);
+inline Chunk* physicalNext(const Chunk* cur_chunk);
+inline Chunk* physicalPrev(const Chunk* cur_chunk);
+inline Chunk* shiftToHeader(const data_t* chunk_ptr);
+
+inline size_t pageSize();
+inline Chunk* mapLargeChunk(const size_t n_bytes, const size_t alignment = 0);
+inline void unmapLargeChunk(Chunk* cur_chunk);
+inline bool remapLargeChunk(Chunk* cur_chunk, const size_t n_bytes);
+inline void releaseFreePages(const Chunk* cur_chunk);
+
+inline bool isCoalesceableNext(const Chunk* chunk_ptr);
+inline bool isCoalesceablePrev(const Chunk* chunk_ptr);
+
+inline void recordSample(const Chunk* user_chunk);
+
+inline data_t* programAllocate(const size_t n_bytes);
+inline void programDeallocate(const data_t* data_ptr);
+inline data_t* programAllocateAligned(const size_t n_bytes, const size_t alignment);
+inline void traceCall(const TraceOp op, const data_t* data_ptr, const size_t n_bytes,
+                      const uint64_t extra = 0);
+
+#ifdef ALLOC_THREAD_SAFE
+inline ThreadCache* threadCache();
+inline data_t* cacheAllocate(const size_t n_aligned_bytes);
+inline bool cacheDeallocate(Chunk* user_chunk);
+#endif  // ALLOC_THREAD_SAFE
+
+/* allocates N bytes (N >= n_bytes) */
+inline data_t* allocate(const size_t n_bytes) {
+    data_t* data = programAllocate(n_bytes);
+
+    traceCall(TraceOp::allocate, data, n_bytes);
+    return data;
 }
 
-inline size_t allocationSize(const size_t n_bytes) {
-    // adding header (Chunk) size BUT without Chunk().m_data (it's part of
-    // user's data)
-    return n_bytes + sizeof(Chunk) - sizeof(std::declval<Chunk>().m_data);
+inline void deallocate(const data_t* data_ptr) {
+    traceCall(TraceOp::deallocate, data_ptr, 0);
+
+    programDeallocate(data_ptr);
 }
 
-Chunk* mapOSmemory(const size_t n_bytes) {
-    if (n_bytes <= 0) {
-        return nullptr;
-    }
+/* grows the block of data_ptr to at least n_bytes without moving it */
+inline bool tryExpand(data_t* data_ptr, const size_t n_bytes) {
+    traceCall(TraceOp::try_expand, data_ptr, n_bytes);
 
-    // obtain pointer of current heap break
-    Chunk* current_chunk = (Chunk*)sbrk(0);
+    return Heap::programHeap().tryExpand(data_ptr, n_bytes);
+}
 
-    if (sbrk(allocationSize(n_bytes)) == (void*)-1) {
-#ifndef ALLOC_NOEXCEPT
-        throw std::bad_alloc();
-#endif  // ALLOC_NOEXCEPT
+/* data is aligned to alignment (a power of two), free it with deallocateAligned */
+inline data_t* allocateAligned(const size_t n_bytes, const size_t alignment) {
+    data_t* data = programAllocateAligned(n_bytes, alignment);
 
-        return nullptr;
-    }
+    traceCall(TraceOp::allocate_aligned, data, n_bytes, alignment);
+    return data;
+}
 
-    return current_chunk;
+/* aligned blocks are ordinary chunks, kept for symmetry with allocateAligned */
+inline void deallocateAligned(const data_t* data_ptr) {
+    deallocate(data_ptr);
 }
 
-Chunk* shiftToHeader(const data_t* chunk_ptr) {
-    if (chunk_ptr == nullptr) {
-#ifndef ALLOC_NOEXCEPT
-        throw std::invalid_argument("chunk pointer is null");
-#endif  // ALLOC_NOEXCEPT
+/* in-place growth when possible, allocate + copy + deallocate otherwise */
+inline data_t* reallocate(data_t* data_ptr, const size_t n_bytes) {
+    data_t* new_data = nullptr;
+
+    if (data_ptr == nullptr) {
+        new_data = programAllocate(n_bytes);
+    } else if (n_bytes == 0) {
+        programDeallocate(data_ptr);
+    } else if (Heap::programHeap().tryExpand(data_ptr, n_bytes)) {
+        new_data = data_ptr;
+    } else if ((new_data = programAllocate(n_bytes)) != nullptr) {
+        memcpy(new_data, data_ptr,
+               std::min(shiftToHeader(data_ptr)->m_size, n_bytes));
+        programDeallocate(data_ptr);
     }
 
-    return (Chunk*)((uint8_t*)chunk_ptr + sizeof(std::declval<Chunk>().m_data) -
-                    sizeof(Chunk));
+    traceCall(TraceOp::reallocate, new_data, n_bytes,
+              reinterpret_cast<uintptr_t>(data_ptr));
+    return new_data;
 }
 
-Chunk* getFreeChunk(const size_t n_bytes) {
-    if (n_bytes <= 0) {
+/* the calls behind the traced free functions above */
+inline data_t* programAllocate(const size_t n_bytes) {
+    if (n_bytes == 0) {
         return nullptr;
     }
 
-    switch (m_mem_mode) {
-        case MemoryManagement::first_fit_search: {
-            return memFirstFit(n_bytes);
-        }
+    Heap& heap = Heap::programHeap();
+    size_t n_aligned_bytes = heap.requestSize(n_bytes);
 
-        case MemoryManagement::next_fit_search: {
-            return memNextFit(n_bytes);
+    if (n_aligned_bytes >= MMAP_THRESHOLD) {
+        // large blocks would pin the program break, map them separately
+        Chunk* mapped_chunk = mapLargeChunk(n_aligned_bytes);
+        if (mapped_chunk == nullptr) {
+            return nullptr;
         }
 
-            /*
-            case MemoryManagement::best_fit_search: {
-                #ifndef ALLOC_NOEXCEPT
-                throw std::runtime_error(
-                        "Don't use best-fit. Rumors say cats hate it...");
-                #endif // ALLOC_NOEXCEPT
-
-                return nullptr;
-            }
-            */
+#ifdef ALLOC_THREAD_SAFE
+        std::lock_guard<std::mutex> heap_lock(heap.m_heap_mutex);
+#endif  // ALLOC_THREAD_SAFE
 
-        case MemoryManagement::free_list_search: {
-            return memFreeList(n_bytes);
-        }
+        heap.recordAllocation(mapped_chunk);
+        return mapped_chunk->m_data;
+    }
 
-        default: {
-#ifndef ALLOC_NOEXCEPT
-            throw std::runtime_error("Unknown MemoryManagement type");
-#endif  // ALLOC_NOEXCEPT
+#ifdef ALLOC_THREAD_SAFE
+    if (n_aligned_bytes <= THREAD_CACHE_MAX_BYTES) {
+        // round up to the size class so the chunk can be cached once freed
+        n_aligned_bytes = (n_aligned_bytes + THREAD_CACHE_CLASS_STEP - 1) /
+                          THREAD_CACHE_CLASS_STEP * THREAD_CACHE_CLASS_STEP;
 
-            fprintf(stderr, "MemoryManagement type unknown. Return NULL.\n");
-            return nullptr;
+        if (data_t* cached_data = cacheAllocate(n_aligned_bytes)) {
+            return cached_data;
         }
     }
-}
 
-Chunk* memFirstFit(const size_t n_bytes) {
-    if (n_bytes <= 0) {
+    ThreadCache* owner_cache = threadCache();
+    std::lock_guard<std::mutex> heap_lock(heap.m_heap_mutex);
+#endif  // ALLOC_THREAD_SAFE
+
+    Chunk* user_chunk = heap.heapAllocate(n_aligned_bytes);
+    if (user_chunk == nullptr) {
         return nullptr;
     }
 
-    size_t loop_iteration_counter = 0;
+#ifdef ALLOC_THREAD_SAFE
+    user_chunk->m_owner = owner_cache;
+#endif  // ALLOC_THREAD_SAFE
 
-    Chunk* current_chunk = m_heap_head;
+    heap.recordAllocation(user_chunk);
+    return user_chunk->m_data;
+}
 
-    if (current_chunk->m_used == false && current_chunk->m_size >= n_bytes) {
-        return current_chunk;
+inline void programDeallocate(const data_t* data_ptr) {
+    if (data_ptr == nullptr) {
+        return;
     }
-    current_chunk = current_chunk->m_next;
 
-    while (current_chunk) {
-        if (current_chunk == m_heap_head ||
-            loop_iteration_counter++ >= TOTAL_CHUNKS_IN_MEMORY) {
-            return nullptr;
-        }
-
-        if (current_chunk->m_used == true || current_chunk->m_size <= n_bytes) {
-            current_chunk = current_chunk->m_next;
-            // continue is needed so we can return current_chunk after the loop
-            continue;
-        }
-
-        return current_chunk;
+#ifdef ALLOC_THREAD_SAFE
+    Chunk* user_chunk = shiftToHeader(data_ptr);
+    if (!user_chunk->m_mapped && cacheDeallocate(user_chunk)) {
+        return;
     }
+#endif  // ALLOC_THREAD_SAFE
 
-    return nullptr;
+    Heap::programHeap().deallocate(data_ptr);
 }
 
-Chunk* memNextFit(const size_t n_bytes) {
-    if (n_bytes <= 0) {
-        return nullptr;
+inline data_t* programAllocateAligned(const size_t n_bytes, const size_t alignment) {
+    if (alignment <= CHUNK_ALIGNMENT) {
+        return programAllocate(n_bytes);
     }
 
-    size_t loop_iterations_counter = 0;
-
-    // restore the last success position
-    Chunk* current_chunk = m_last_found != nullptr ? m_last_found : m_heap_head;
+    if (n_bytes == 0 || (alignment & (alignment - 1)) != 0) {
+#ifndef ALLOC_NOEXCEPT
+        throw std::invalid_argument("alignment is not a power of two");
+#endif  // ALLOC_NOEXCEPT
 
-    if (current_chunk->m_used == false && current_chunk->m_size >= n_bytes) {
-        return current_chunk;
+        return nullptr;
     }
-    current_chunk = current_chunk->m_next;
 
-    while (current_chunk) {
-        if (current_chunk == m_last_found ||
-            loop_iterations_counter++ >= TOTAL_CHUNKS_IN_MEMORY) {
+    Heap& heap = Heap::programHeap();
+    size_t n_aligned_bytes = heap.alignedRequestSize(n_bytes);
+
+    if (n_aligned_bytes + alignment + heap.alignLeadBytes() >= MMAP_THRESHOLD) {
+        Chunk* mapped_chunk = mapLargeChunk(n_aligned_bytes, alignment);
+        if (mapped_chunk == nullptr) {
             return nullptr;
         }
 
-        if (current_chunk->m_used == true || current_chunk->m_size <= n_bytes) {
-            current_chunk = current_chunk->m_next;
-            // continue is needed so we can return current_chunk after the loop
-            continue;
-        }
+#ifdef ALLOC_THREAD_SAFE
+        std::lock_guard<std::mutex> heap_lock(heap.m_heap_mutex);
+#endif  // ALLOC_THREAD_SAFE
 
-        // update last success position
-        m_last_found = current_chunk;
-        return current_chunk;
+        heap.recordAllocation(mapped_chunk);
+        return mapped_chunk->m_data;
     }
 
-    return nullptr;
+#ifdef ALLOC_THREAD_SAFE
+    ThreadCache* owner_cache = threadCache();
+    std::lock_guard<std::mutex> heap_lock(heap.m_heap_mutex);
+#endif  // ALLOC_THREAD_SAFE
+
+    Chunk* user_chunk = heap.heapAllocateAligned(n_aligned_bytes, alignment);
+    if (user_chunk == nullptr) {
+        return nullptr;
+    }
+
+#ifdef ALLOC_THREAD_SAFE
+    user_chunk->m_owner = owner_cache;
+#endif  // ALLOC_THREAD_SAFE
+
+    heap.recordAllocation(user_chunk);
+    return user_chunk->m_data;
 }
 
-Chunk* splitChunk(Chunk* cur_chunk, const size_t n_bytes) {
-    if (isSplittable(cur_chunk, n_bytes)) {
-        size_t splitted_chunk_old_size = cur_chunk->m_size;
-        cur_chunk->m_size = n_bytes;
+#ifdef ALLOC_THREAD_SAFE
+/* cached chunks of every thread are dropped together with the program heap,
+ * the caller holds the heap so this does not race with allocations */
+inline void dropCachedChunks() {
+    ++m_heap_generation;
+    for (DepotBin& depot_bin : m_depot) {
+        std::lock_guard<std::mutex> depot_lock(depot_bin.m_mutex);
 
-        Chunk* next_chunk_pointer =
-            (Chunk*)(((uint8_t*)cur_chunk) + allocationSize(0) +
-                     cur_chunk->m_size);
-        next_chunk_pointer->m_size =
-            splitted_chunk_old_size - cur_chunk->m_size - allocationSize(0);
+        depot_bin.m_head = nullptr;
+        depot_bin.m_length = 0;
+    }
+}
+#endif  // ALLOC_THREAD_SAFE
 
-        next_chunk_pointer->m_used = false;
-        next_chunk_pointer->m_next = cur_chunk->m_next;
-        next_chunk_pointer->m_prev = cur_chunk;
+inline void resetProgramHeap() {
+    Heap& heap = Heap::programHeap();
 
-        cur_chunk->m_next = next_chunk_pointer;
-        return cur_chunk;
+#ifdef ALLOC_THREAD_SAFE
+    {
+        std::lock_guard<std::mutex> heap_lock(heap.m_heap_mutex);
+        dropCachedChunks();
     }
+#endif  // ALLOC_THREAD_SAFE
 
-    return nullptr;
+    heap.reset();
 }
 
-inline bool isSplittable(const Chunk* cur_chunk, const size_t n_bytes) {
-    // free space left for the rest part of out empty block is not allowed to be
-    // less than 16
-    return cur_chunk->m_size - n_bytes - allocationSize(0) >=
-           SPLIT_RATE_MIN_BYTES;
+inline void configure(MemoryManagement search_mode) {
+    Heap& heap = Heap::programHeap();
+
+#ifdef ALLOC_THREAD_SAFE
+    {
+        std::lock_guard<std::mutex> heap_lock(heap.m_heap_mutex);
+        dropCachedChunks();
+    }
+#endif  // ALLOC_THREAD_SAFE
+
+    heap.configure(search_mode);
 }
 
-Chunk* allocateFromList(Chunk* cur_chunk, const size_t n_bytes) {
+////////////////////////////////////////////////////////////
+/// Heap
+////////////////////////////////////////////////////////////
+
+inline Heap::Heap(MemoryManagement search_mode, const size_t region_bytes)
+    : m_mem_mode(search_mode) {
+    size_t map_bytes = (region_bytes + pageSize() - 1) & ~(pageSize() - 1);
+
+    // only address space is reserved, pages come when the break reaches them
+    void* region = mmap(nullptr, map_bytes, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (region == MAP_FAILED) {
 #ifndef ALLOC_NOEXCEPT
-    if (cur_chunk == nullptr) {
-        throw std::invalid_argument("chunk pointer is null");
-    }
-#endif
+        throw std::bad_alloc();
+#endif  // ALLOC_NOEXCEPT
 
-    if (isSplittable(cur_chunk, n_bytes)) {
-        cur_chunk = splitChunk(cur_chunk, n_bytes);
+        // an empty region, every allocation fails
+        return;
     }
 
-    cur_chunk->m_used = true;
-    return cur_chunk;
+    m_region_begin = m_region_break = reinterpret_cast<uint8_t*>(region);
+    m_region_end = m_region_begin + map_bytes;
 }
 
-inline bool isCoalesceableNext(const Chunk* chunk_ptr) {
-    if (chunk_ptr == nullptr) {
-        return false;
-    }
+inline Heap::Heap(ProgramBreak) : m_program_break(true) {}
 
-    return chunk_ptr->m_next != nullptr && chunk_ptr->m_next->m_used == false;
+inline Heap::~Heap() {
+    if (m_region_begin != nullptr) {
+        munmap(m_region_begin, m_region_end - m_region_begin);
+    }
 }
 
-inline bool isCoalesceablePrev(const Chunk* chunk_ptr) {
-    if (chunk_ptr == nullptr) {
-        return false;
-    }
+inline Heap& Heap::programHeap() {
+    // never destroyed: static destructors may still free program heap chunks
+    alignas(Heap) static uint8_t heap_storage[sizeof(Heap)];
+    static Heap* program_heap = new (heap_storage) Heap(ProgramBreak{});
 
-    return chunk_ptr->m_prev != nullptr && chunk_ptr->m_prev->m_used == false;
+    return *program_heap;
 }
 
-Chunk* coalesceChunk(Chunk* cur_chunk) {
-    if (cur_chunk == nullptr || cur_chunk->m_next == nullptr) {
-#ifndef ALLOC_NOEXCEPT
-        throw std::invalid_argument(
-            "coalesce chunks is broken, report it to devs");
-#endif  // !ALLOC_NOEXCEPT
+inline data_t* Heap::allocate(const size_t n_bytes) {
+    if (n_bytes == 0) {
+        return nullptr;
     }
 
-    Chunk* next_chunk = cur_chunk->m_next;
+    size_t n_aligned_bytes = requestSize(n_bytes);
 
-    cur_chunk->m_next = next_chunk->m_next;
-    cur_chunk->m_size += allocationSize(next_chunk->m_size);
+#ifdef ALLOC_THREAD_SAFE
+    std::lock_guard<std::mutex> heap_lock(m_heap_mutex);
+#endif  // ALLOC_THREAD_SAFE
 
-    // NO poison values - just leave next header as a trash in memory
+    Chunk* user_chunk = heapAllocate(n_aligned_bytes);
+    if (user_chunk == nullptr) {
+        return nullptr;
+    }
 
-    return cur_chunk;
+#ifdef ALLOC_THREAD_SAFE
+    user_chunk->m_owner = nullptr;
+#endif  // ALLOC_THREAD_SAFE
+
+    recordAllocation(user_chunk);
+    return user_chunk->m_data;
 }
 
-Chunk* memFreeList(const size_t n_bytes) {
-    if (n_bytes <= 0) {
-        return nullptr;
+inline void Heap::deallocate(const data_t* data_ptr) {
+    if (data_ptr == nullptr) {
+        return;
     }
 
-    for (const auto& cur_chunk : m_free_list) {
-        if (cur_chunk->m_size < n_bytes) {
-            continue;
+    Chunk* user_chunk = shiftToHeader(data_ptr);
+
+    if (user_chunk->m_mapped) {
+        {
+#ifdef ALLOC_THREAD_SAFE
+            std::lock_guard<std::mutex> heap_lock(m_heap_mutex);
+#endif  // ALLOC_THREAD_SAFE
+
+            recordLiveBytes(user_chunk, -(ptrdiff_t)user_chunk->m_size);
         }
 
-        m_free_list.remove(cur_chunk);
-        return allocateFromList(cur_chunk, n_bytes);
+        unmapLargeChunk(user_chunk);
+        return;
     }
 
-    return nullptr;
+#ifdef ALLOC_THREAD_SAFE
+    std::lock_guard<std::mutex> heap_lock(m_heap_mutex);
+#endif  // ALLOC_THREAD_SAFE
+
+    releaseChunk(user_chunk);
 }
 
+inline bool Heap::tryExpand(data_t* data_ptr, const size_t n_bytes) {
+    if (data_ptr == nullptr) {
+        return false;
+    }
+
+    Chunk* user_chunk = shiftToHeader(data_ptr);
+    size_t n_aligned_bytes = alignBytes(n_bytes);
+
+    if (user_chunk->m_size >= n_aligned_bytes) {
+        return true;
+    }
+
+    size_t old_size = user_chunk->m_size;
+
+    if (user_chunk->m_mapped) {
+        if (!remapLargeChunk(user_chunk, n_aligned_bytes)) {
+            return false;
+        }
+
+#ifdef ALLOC_THREAD_SAFE
+        std::lock_guard<std::mutex> heap_lock(m_heap_mutex);
+#endif  // ALLOC_THREAD_SAFE
+
+        recordLiveBytes(user_chunk, user_chunk->m_size - old_size);
+        return true;
+    }
+
+#ifdef ALLOC_THREAD_SAFE
+    std::lock_guard<std::mutex> heap_lock(m_heap_mutex);
+#endif  // ALLOC_THREAD_SAFE
+
+    if (!expandChunk(user_chunk, n_aligned_bytes)) {
+        return false;
+    }
+
+    recordLiveBytes(user_chunk, user_chunk->m_size - old_size);
+    return true;
+}
+
+inline data_t* Heap::reallocate(data_t* data_ptr, const size_t n_bytes) {
+    if (data_ptr == nullptr) {
+        return allocate(n_bytes);
+    }
+
+    if (n_bytes == 0) {
+        deallocate(data_ptr);
+        return nullptr;
+    }
+
+    if (tryExpand(data_ptr, n_bytes)) {
+        return data_ptr;
+    }
+
+    data_t* new_data = allocate(n_bytes);
+    if (new_data == nullptr) {
+        return nullptr;
+    }
+
+    memcpy(new_data, data_ptr, std::min(shiftToHeader(data_ptr)->m_size, n_bytes));
+    deallocate(data_ptr);
+
+    return new_data;
+}
+
+inline data_t* Heap::allocateAligned(const size_t n_bytes, const size_t alignment) {
+    if (alignment <= CHUNK_ALIGNMENT) {
+        return allocate(n_bytes);
+    }
+
+    if (n_bytes == 0 || (alignment & (alignment - 1)) != 0) {
+#ifndef ALLOC_NOEXCEPT
+        throw std::invalid_argument("alignment is not a power of two");
+#endif  // ALLOC_NOEXCEPT
+
+        return nullptr;
+    }
+
+    size_t n_aligned_bytes = alignedRequestSize(n_bytes);
+
+#ifdef ALLOC_THREAD_SAFE
+    std::lock_guard<std::mutex> heap_lock(m_heap_mutex);
+#endif  // ALLOC_THREAD_SAFE
+
+    Chunk* user_chunk = heapAllocateAligned(n_aligned_bytes, alignment);
+    if (user_chunk == nullptr) {
+        return nullptr;
+    }
+
+#ifdef ALLOC_THREAD_SAFE
+    user_chunk->m_owner = nullptr;
+#endif  // ALLOC_THREAD_SAFE
+
+    recordAllocation(user_chunk);
+    return user_chunk->m_data;
+}
+
+inline void Heap::reset() {
+#ifdef ALLOC_THREAD_SAFE
+    std::lock_guard<std::mutex> heap_lock(m_heap_mutex);
+#endif  // ALLOC_THREAD_SAFE
+
+    dropChunks();
+}
+
+inline void Heap::configure(MemoryManagement search_mode) {
+#ifdef ALLOC_THREAD_SAFE
+    std::lock_guard<std::mutex> heap_lock(m_heap_mutex);
+#endif  // ALLOC_THREAD_SAFE
+
+    m_mem_mode = search_mode;
+
+    dropChunks();
+}
+
+inline size_t Heap::requestSize(const size_t n_bytes) const {
+    return std::max(alignBytes(n_bytes), std::max(MIN_ALLOC_SIZE, minPayloadSize()));
+}
+
+inline size_t Heap::alignedRequestSize(const size_t n_bytes) const {
+    return std::max(
+        alignBytes(n_bytes),
+        std::max(SPLIT_RATE_MIN_BYTES, std::max(MIN_ALLOC_SIZE, minPayloadSize())));
+}
+
+inline size_t Heap::alignLeadBytes() const {
+    // a misaligned front part is cut off as a free chunk of its own, so it
+    // must be big enough to be one
+    return allocationSize(0) + std::max(SPLIT_RATE_MIN_BYTES, minPayloadSize());
+}
+
+/* takes an already aligned size, the caller holds the heap */
+inline Chunk* Heap::heapAllocate(const size_t n_aligned_bytes) {
+    if (Chunk* reused_chunk = getFreeChunk(n_aligned_bytes)) {
+        return reused_chunk;
+    }
+
+    // a free chunk right below the break only needs the missing bytes
+    if (Chunk* extended_chunk = extendHeapTop(n_aligned_bytes)) {
+        return extended_chunk;
+    }
+
+    // map exactly what m_size will claim, otherwise the aligned tail of the
+    // chunk lies beyond the break
+    Chunk* new_chunk = mapOSmemory(n_aligned_bytes);
+    if (new_chunk == nullptr) {
+#ifndef ALLOC_NOEXCEPT
+        throw std::bad_alloc();
+#endif  // ALLOC_NOEXCEPT
+
+        return nullptr;
+    }
+    ++m_total_chunks;
+
+    new_chunk->m_used = true;
+    new_chunk->m_mapped = false;
+    new_chunk->m_prev = nullptr;
+    new_chunk->m_next = nullptr;
+    new_chunk->m_size = n_aligned_bytes;
+
+    // somebody else may have moved the break since the last chunk, never
+    // coalesce across such a gap
+    new_chunk->m_prev_used = true;
+    new_chunk->m_segment_end = true;
+    if (m_heap_tail != nullptr && physicalNext(m_heap_tail) == nullptr &&
+        (uint8_t*)m_heap_tail + allocationSize(m_heap_tail->m_size) ==
+            (uint8_t*)new_chunk) {
+        new_chunk->m_prev_used = m_heap_tail->m_used;
+        m_heap_tail->m_segment_end = false;
+    }
+
+    if (m_heap_head == nullptr) {
+        m_heap_head = new_chunk;
+    }
+
+    if (m_heap_tail != nullptr) {
+        m_heap_tail->m_next = new_chunk;
+        new_chunk->m_prev = m_heap_tail;
+        new_chunk->m_next = m_heap_head;
+    }
+
+    m_heap_tail = new_chunk;
+
+    return new_chunk;
+}
+
+/* takes alignedRequestSize(), the caller holds the heap */
+inline Chunk* Heap::heapAllocateAligned(const size_t n_aligned_bytes,
+                                        const size_t alignment) {
+    size_t lead_bytes = alignLeadBytes();
+
+    Chunk* user_chunk = heapAllocate(n_aligned_bytes + alignment + lead_bytes);
+    if (user_chunk == nullptr) {
+        return nullptr;
+    }
+
+    uintptr_t data_address = reinterpret_cast<uintptr_t>(user_chunk->m_data);
+    if ((data_address & (alignment - 1)) != 0) {
+        uintptr_t aligned_address =
+            (data_address + lead_bytes + alignment - 1) & ~(alignment - 1);
+
+        Chunk* lead_chunk = user_chunk;
+        splitChunk(lead_chunk, aligned_address - data_address - allocationSize(0));
+        user_chunk = lead_chunk->m_next;
+
+        user_chunk->m_used = true;
+        user_chunk->m_prev_used = true;
+
+        // the front part was never counted as live
+        recordLiveBytes(lead_chunk, lead_chunk->m_size);
+        releaseChunk(lead_chunk);
+    }
+
+    // hand the rest part behind the block back to the heap, freed like any
+    // other chunk so its successor learns about it and it can coalesce
+    if (splitChunk(user_chunk, n_aligned_bytes) != nullptr) {
+        Chunk* rest_chunk = user_chunk->m_next;
+        rest_chunk->m_used = true;
+
+        recordLiveBytes(rest_chunk, rest_chunk->m_size);
+        releaseChunk(rest_chunk);
+    }
+
+    return user_chunk;
+}
+
+/* returns a chunk to the heap, the caller holds the heap */
+inline void Heap::releaseChunk(Chunk* user_chunk) {
+    recordLiveBytes(user_chunk, -(ptrdiff_t)user_chunk->m_size);
+
+    // free_list_search puts coalescing off until its bins run dry
+    if (m_mem_mode == MemoryManagement::free_list_search) {
+        ++m_deferred_frees;
+    } else {
+        if (isCoalesceablePrev(user_chunk)) {
+            user_chunk = physicalPrev(user_chunk);
+            detachFreeChunk(user_chunk);
+            user_chunk = coalesceChunk(user_chunk);
+        }
+        if (isCoalesceableNext(user_chunk)) {
+            detachFreeChunk(physicalNext(user_chunk));
+            user_chunk = coalesceChunk(user_chunk);
+        }
+    }
+
+    user_chunk->m_used = false;
+    chunkFooter(user_chunk) = user_chunk->m_size;
+    if (Chunk* next_chunk = physicalNext(user_chunk)) {
+        next_chunk->m_prev_used = false;
+    }
+
+    attachFreeChunk(user_chunk);
+
+    if (!trimHeapTop(user_chunk)) {
+        releaseFreePages(user_chunk);
+    }
+}
+
+/* forgets every chunk, the caller holds the heap */
+inline void Heap::dropChunks() {
+    // mapped chunks are not part of the program heap and stay alive, search
+    // counters are kept per mode so the modes can be compared afterwards
+    m_heap_stats.m_bytes_live = 0;
+    m_heap_stats.m_bytes_peak = m_heap_stats.m_bytes_mapped;
+    m_heap_stats.m_bytes_heap_peak = 0;
+
+    if (m_heap_head == nullptr) {
+        return;
+    }
+
+    // lowering the program break is only safe while nobody else (e.g. malloc)
+    // owns memory inside or above the heap, otherwise the chunks are just
+    // dropped
+    Chunk* last_chunk = m_heap_head;
+    while (physicalNext(last_chunk) != nullptr) {
+        last_chunk = physicalNext(last_chunk);
+    }
+
+    if (last_chunk == m_heap_tail &&
+        (uint8_t*)last_chunk + allocationSize(last_chunk->m_size) == currentBreak()) {
+        lowerBreak(m_heap_head);
+    }
+
+    m_heap_head = nullptr;
+    m_heap_tail = nullptr;
+    m_last_found = nullptr;
+
+    std::fill(m_bin_heads, m_bin_heads + FREE_LIST_BINS, nullptr);
+    std::fill(m_bin_tails, m_bin_tails + FREE_LIST_BINS, nullptr);
+    std::fill(m_bin_map, m_bin_map + FREE_LIST_MAP_WORDS, 0);
+    m_free_list_bytes = 0;
+    m_deferred_frees = 0;
+    m_size_index_root = nullptr;
+    m_total_chunks = 0;
+
+    // memory that could not be given back is lost to the heap as well
+    m_heap_stats.m_bytes_heap = 0;
+}
+
+inline void* Heap::currentBreak() const {
+    return m_program_break ? sbrk(0) : m_region_break;
+}
+
+/* moves the break up by n_bytes, returns the old break or nullptr */
+inline void* Heap::moveBreak(const size_t n_bytes) {
+    void* old_break = nullptr;
+
+    if (m_program_break) {
+        old_break = sbrk(n_bytes);
+        if (old_break == (void*)-1) {
+            return nullptr;
+        }
+    } else {
+        if (n_bytes > (size_t)(m_region_end - m_region_break)) {
+            return nullptr;
+        }
+
+        old_break = m_region_break;
+        m_region_break += n_bytes;
+    }
+
+    m_heap_stats.m_bytes_heap += n_bytes;
+    m_heap_stats.m_bytes_heap_peak =
+        std::max(m_heap_stats.m_bytes_heap_peak, m_heap_stats.m_bytes_heap);
+
+    return old_break;
+}
+
+inline void Heap::lowerBreak(void* new_break) {
+    size_t released_bytes = (uint8_t*)currentBreak() - (uint8_t*)new_break;
+    m_heap_stats.m_bytes_heap -= std::min(released_bytes, m_heap_stats.m_bytes_heap);
+
+    if (m_program_break) {
+        brk(new_break);
+        return;
+    }
+
+    // the region stays reserved, only its pages go back
+    uintptr_t release_begin =
+        (reinterpret_cast<uintptr_t>(new_break) + pageSize() - 1) & ~(pageSize() - 1);
+    uintptr_t release_end =
+        (reinterpret_cast<uintptr_t>(m_region_break) + pageSize() - 1) &
+        ~(pageSize() - 1);
+
+    if (release_begin < release_end) {
+        madvise(reinterpret_cast<void*>(release_begin),
+                release_end - release_begin, MADV_DONTNEED);
+    }
+
+    m_region_break = reinterpret_cast<uint8_t*>(new_break);
+}
+
+inline size_t alignBytes(const size_t n_bytes) {
+    /* CHUNK_ALIGNMENT = 8 -> 7 is 111 -> ~7 is 000 -> last 3 bits will be
+     * zeros*/
+    return ~(CHUNK_ALIGNMENT - 1) & (n_bytes + CHUNK_ALIGNMENT - 1);
+}
+
+inline size_t allocationSize(const size_t n_bytes) {
+    // adding header (Chunk) size BUT without Chunk().m_data (it's part of
+    // user's data)
+    return n_bytes + offsetof(Chunk, m_data);
+}
+
+inline size_t Heap::minPayloadSize() const {
+    // once freed, every chunk must hold its footer and, for best-fit and
+    // free-list, the index or list node in front of it
+    switch (m_mem_mode) {
+        case MemoryManagement::best_fit_search: {
+            return alignBytes(sizeof(SizeIndexNode) + sizeof(size_t));
+        }
+
+        case MemoryManagement::free_list_search: {
+            return alignBytes(sizeof(FreeListNode) + sizeof(size_t));
+        }
+
+        default: {
+            return alignBytes(sizeof(size_t));
+        }
+    }
+}
+
+inline size_t& chunkFooter(Chunk* cur_chunk) {
+    return *reinterpret_cast<size_t*>((uint8_t*)cur_chunk->m_data +
+                                      cur_chunk->m_size - sizeof(size_t));
+}
+
+inline Chunk* physicalNext(const Chunk* cur_chunk) {
+    if (cur_chunk->m_segment_end) {
+        return nullptr;
+    }
+
+    return (Chunk*)((uint8_t*)cur_chunk + allocationSize(cur_chunk->m_size));
+}
+
+/* valid only while the previous chunk is free (m_prev_used == false) */
+inline Chunk* physicalPrev(const Chunk* cur_chunk) {
+    size_t prev_size = *(reinterpret_cast<const size_t*>(cur_chunk) - 1);
+
+    return (Chunk*)((uint8_t*)cur_chunk - allocationSize(prev_size));
+}
+
+inline Chunk* Heap::mapOSmemory(const size_t n_bytes) {
+    if (n_bytes <= 0) {
+        return nullptr;
+    }
+
+    // somebody else may have left the break unaligned
+    size_t lead_bytes = -(uintptr_t)currentBreak() & (CHUNK_ALIGNMENT - 1);
+
+    // obtain pointer of current heap break
+    uint8_t* old_break = (uint8_t*)moveBreak(lead_bytes + allocationSize(n_bytes));
+    Chunk* current_chunk = old_break != nullptr ? (Chunk*)(old_break + lead_bytes) : nullptr;
+
+    if (current_chunk == nullptr) {
+#ifndef ALLOC_NOEXCEPT
+        throw std::bad_alloc();
+#endif  // ALLOC_NOEXCEPT
+
+        return nullptr;
+    }
+
+    return current_chunk;
+}
+
+inline size_t pageSize() {
+    static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return page_size;
+}
+
+inline Chunk* mapLargeChunk(const size_t n_bytes, const size_t alignment) {
+    size_t map_bytes =
+        (allocationSize(n_bytes) + alignment + pageSize() - 1) & ~(pageSize() - 1);
+
+    void* mapping = mmap(nullptr, map_bytes, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+#ifndef ALLOC_NOEXCEPT
+        throw std::bad_alloc();
+#endif  // ALLOC_NOEXCEPT
+
+        return nullptr;
+    }
+
+    uintptr_t map_begin = reinterpret_cast<uintptr_t>(mapping);
+    uintptr_t map_end = map_begin + map_bytes;
+
+    uintptr_t data_address = map_begin + allocationSize(0);
+    if (alignment != 0) {
+        data_address = (data_address + alignment - 1) & ~(alignment - 1);
+
+        // whole pages in front of the header are not needed at all
+        uintptr_t header_page =
+            (data_address - allocationSize(0)) & ~(pageSize() - 1);
+        if (header_page > map_begin) {
+            munmap(mapping, header_page - map_begin);
+            map_begin = header_page;
+        }
+    }
+
+    Chunk* mapped_chunk = reinterpret_cast<Chunk*>(data_address - allocationSize(0));
+
+    // the rest of the last page is given to the user as well
+    mapped_chunk->m_size = map_end - data_address;
+    mapped_chunk->m_used = true;
+    mapped_chunk->m_mapped = true;
+    // mapped chunks are never linked, m_prev keeps the start of the mapping
+    mapped_chunk->m_prev = reinterpret_cast<Chunk*>(map_begin);
+    mapped_chunk->m_next = nullptr;
+#ifdef ALLOC_THREAD_SAFE
+    mapped_chunk->m_owner = nullptr;
+#endif  // ALLOC_THREAD_SAFE
+
+    return mapped_chunk;
+}
+
+inline void unmapLargeChunk(Chunk* cur_chunk) {
+    uint8_t* map_begin = reinterpret_cast<uint8_t*>(cur_chunk->m_prev);
+    uint8_t* map_end = (uint8_t*)cur_chunk + allocationSize(cur_chunk->m_size);
+
+    munmap(map_begin, map_end - map_begin);
+}
+
+/* grows a mapped chunk where it is, n_bytes is already aligned */
+inline bool remapLargeChunk(Chunk* cur_chunk, const size_t n_bytes) {
+    if (cur_chunk->m_prev != cur_chunk) {
+        // shifted by allocateAligned(), not at the start of its mapping
+        return false;
+    }
+
+    // flags = 0: the mapping may only grow where it is
+    size_t old_map_bytes = allocationSize(cur_chunk->m_size);
+    size_t new_map_bytes =
+        (allocationSize(n_bytes) + pageSize() - 1) & ~(pageSize() - 1);
+
+    if (mremap(cur_chunk, old_map_bytes, new_map_bytes, 0) == MAP_FAILED) {
+        return false;
+    }
+
+    cur_chunk->m_size = new_map_bytes - allocationSize(0);
+    return true;
+}
+
+/* gives a free tail chunk back to the OS, the caller holds the heap */
+inline bool Heap::trimHeapTop(Chunk* cur_chunk) {
+    if (cur_chunk != m_heap_tail || cur_chunk->m_size < TRIM_THRESHOLD) {
+        return false;
+    }
+
+    // somebody else (e.g. malloc) may have moved the break past the heap
+    if ((uint8_t*)cur_chunk + allocationSize(cur_chunk->m_size) != currentBreak()) {
+        return false;
+    }
+
+    detachFreeChunk(cur_chunk);
+
+    if (cur_chunk == m_heap_head) {
+        m_heap_head = nullptr;
+        m_heap_tail = nullptr;
+    } else {
+        m_heap_tail = cur_chunk->m_prev;
+        // a single chunk does not wrap around
+        m_heap_tail->m_next =
+            m_heap_tail == m_heap_head ? nullptr : m_heap_head;
+        m_heap_tail->m_segment_end = true;
+    }
+
+    if (m_last_found == cur_chunk) {
+        m_last_found = nullptr;
+    }
+    --m_total_chunks;
+
+    lowerBreak(cur_chunk);
+    return true;
+}
+
+/* drops the physical pages behind a large free chunk, keeps its address range */
+inline void releaseFreePages(const Chunk* cur_chunk) {
+    if (cur_chunk->m_size < RELEASE_THRESHOLD) {
+        return;
+    }
+
+    // the payload head holds free-list links and the last word is the footer,
+    // both have to survive
+    uintptr_t release_begin =
+        (reinterpret_cast<uintptr_t>(cur_chunk->m_data) + sizeof(SizeIndexNode) +
+         pageSize() - 1) &
+        ~(pageSize() - 1);
+    uintptr_t release_end =
+        (reinterpret_cast<uintptr_t>(cur_chunk->m_data) + cur_chunk->m_size -
+         sizeof(size_t)) &
+        ~(pageSize() - 1);
+
+    if (release_begin < release_end) {
+        madvise(reinterpret_cast<void*>(release_begin),
+                release_end - release_begin, MADV_DONTNEED);
+    }
+}
+
+inline Chunk* shiftToHeader(const data_t* chunk_ptr) {
+    if (chunk_ptr == nullptr) {
+#ifndef ALLOC_NOEXCEPT
+        throw std::invalid_argument("chunk pointer is null");
+#endif  // ALLOC_NOEXCEPT
+    }
+
+    return (Chunk*)((uint8_t*)chunk_ptr - offsetof(Chunk, m_data));
+}
+
+inline Chunk* Heap::getFreeChunk(const size_t n_bytes) {
+    if (n_bytes <= 0 || m_heap_head == nullptr) {
+        return nullptr;
+    }
+
+    ++m_heap_stats.m_searches[static_cast<size_t>(m_mem_mode)];
+
+    switch (m_mem_mode) {
+        case MemoryManagement::first_fit_search: {
+            return memFirstFit(n_bytes);
+        }
+
+        case MemoryManagement::next_fit_search: {
+            return memNextFit(n_bytes);
+        }
+
+        case MemoryManagement::best_fit_search: {
+            return memBestFit(n_bytes);
+        }
+
+        case MemoryManagement::free_list_search: {
+            return memFreeList(n_bytes);
+        }
+
+        default: {
+#ifndef ALLOC_NOEXCEPT
+            throw std::runtime_error("Unknown MemoryManagement type");
+#endif  // ALLOC_NOEXCEPT
+
+            fprintf(stderr, "MemoryManagement type unknown. Return NULL.\n");
+            return nullptr;
+        }
+    }
+}
+
+inline Chunk* Heap::memFirstFit(const size_t n_bytes) {
+    if (n_bytes <= 0) {
+        return nullptr;
+    }
+
+    size_t loop_iteration_counter = 0;
+
+    Chunk* current_chunk = m_heap_head;
+
+    countSearchStep();
+    if (current_chunk->m_used == false && current_chunk->m_size >= n_bytes) {
+        return allocateFromList(current_chunk, n_bytes);
+    }
+    current_chunk = current_chunk->m_next;
+
+    while (current_chunk) {
+        countSearchStep();
+        if (current_chunk == m_heap_head ||
+            loop_iteration_counter++ >= m_total_chunks) {
+            return nullptr;
+        }
+
+        if (current_chunk->m_used == true || current_chunk->m_size <= n_bytes) {
+            current_chunk = current_chunk->m_next;
+            // continue is needed so we can return current_chunk after the loop
+            continue;
+        }
+
+        return allocateFromList(current_chunk, n_bytes);
+    }
+
+    return nullptr;
+}
+
+inline Chunk* Heap::memNextFit(const size_t n_bytes) {
+    if (n_bytes <= 0) {
+        return nullptr;
+    }
+
+    size_t loop_iterations_counter = 0;
+
+    // restore the last success position
+    Chunk* current_chunk = m_last_found != nullptr ? m_last_found : m_heap_head;
+
+    countSearchStep();
+    if (current_chunk->m_used == false && current_chunk->m_size >= n_bytes) {
+        return allocateFromList(current_chunk, n_bytes);
+    }
+    current_chunk = current_chunk->m_next;
+
+    while (current_chunk) {
+        countSearchStep();
+        if (current_chunk == m_last_found ||
+            loop_iterations_counter++ >= m_total_chunks) {
+            return nullptr;
+        }
+
+        if (current_chunk->m_used == true || current_chunk->m_size <= n_bytes) {
+            current_chunk = current_chunk->m_next;
+            // continue is needed so we can return current_chunk after the loop
+            continue;
+        }
+
+        // update last success position
+        m_last_found = current_chunk;
+        return allocateFromList(current_chunk, n_bytes);
+    }
+
+    return nullptr;
+}
+
+inline Chunk* Heap::splitChunk(Chunk* cur_chunk, const size_t n_bytes) {
+    if (isSplittable(cur_chunk, n_bytes)) {
+        size_t splitted_chunk_old_size = cur_chunk->m_size;
+        cur_chunk->m_size = n_bytes;
+
+        Chunk* next_chunk_pointer =
+            (Chunk*)(((uint8_t*)cur_chunk) + allocationSize(0) +
+                     cur_chunk->m_size);
+        next_chunk_pointer->m_size =
+            splitted_chunk_old_size - cur_chunk->m_size - allocationSize(0);
+
+        next_chunk_pointer->m_used = false;
+        next_chunk_pointer->m_mapped = false;
+        next_chunk_pointer->m_next = cur_chunk->m_next;
+        next_chunk_pointer->m_prev = cur_chunk;
+
+        // the front part is handed out right after the split
+        next_chunk_pointer->m_prev_used = true;
+        next_chunk_pointer->m_segment_end = cur_chunk->m_segment_end;
+        cur_chunk->m_segment_end = false;
+        chunkFooter(next_chunk_pointer) = next_chunk_pointer->m_size;
+
+        if (cur_chunk->m_next != nullptr && cur_chunk->m_next != m_heap_head) {
+            cur_chunk->m_next->m_prev = next_chunk_pointer;
+        }
+
+        cur_chunk->m_next = next_chunk_pointer;
+        if (m_heap_tail == cur_chunk) {
+            m_heap_tail = next_chunk_pointer;
+        }
+        ++m_total_chunks;
+
+        return cur_chunk;
+    }
+
+    return nullptr;
+}
+
+inline bool Heap::isSplittable(const Chunk* cur_chunk, const size_t n_bytes) const {
+    // free space left for the rest part of out empty block is not allowed to be
+    // less than 16 (or than an index node in best-fit mode)
+    return cur_chunk->m_size >= n_bytes + allocationSize(0) +
+                                    std::max(SPLIT_RATE_MIN_BYTES,
+                                             minPayloadSize());
+}
+
+inline Chunk* Heap::allocateFromList(Chunk* cur_chunk, const size_t n_bytes) {
+#ifndef ALLOC_NOEXCEPT
+    if (cur_chunk == nullptr) {
+        throw std::invalid_argument("chunk pointer is null");
+    }
+#endif
+
+    if (isSplittable(cur_chunk, n_bytes)) {
+        cur_chunk = splitChunk(cur_chunk, n_bytes);
+        // the rest part becomes searchable again
+        attachFreeChunk(cur_chunk->m_next);
+    }
+
+    cur_chunk->m_used = true;
+    if (Chunk* next_chunk = physicalNext(cur_chunk)) {
+        next_chunk->m_prev_used = true;
+    }
+
+    return cur_chunk;
+}
+
+inline bool isCoalesceableNext(const Chunk* chunk_ptr) {
+    if (chunk_ptr == nullptr) {
+        return false;
+    }
+
+    // list links are not neighbours (tail wraps around, gaps in the break),
+    // only the physical successor may be merged
+    const Chunk* next_chunk = physicalNext(chunk_ptr);
+    return next_chunk != nullptr && next_chunk->m_used == false;
+}
+
+inline bool isCoalesceablePrev(const Chunk* chunk_ptr) {
+    if (chunk_ptr == nullptr) {
+        return false;
+    }
+
+    return chunk_ptr->m_prev_used == false;
+}
+
+/* merges cur_chunk with its physical successor */
+inline Chunk* Heap::coalesceChunk(Chunk* cur_chunk) {
+    if (cur_chunk == nullptr || physicalNext(cur_chunk) == nullptr) {
+#ifndef ALLOC_NOEXCEPT
+        throw std::invalid_argument(
+            "coalesce chunks is broken, report it to devs");
+#endif  // !ALLOC_NOEXCEPT
+    }
+
+    // chunks of one segment are linked in address order, so the physical
+    // successor is the list successor as well
+    Chunk* next_chunk = physicalNext(cur_chunk);
+
+    cur_chunk->m_next = next_chunk->m_next;
+    cur_chunk->m_size += allocationSize(next_chunk->m_size);
+    cur_chunk->m_segment_end = next_chunk->m_segment_end;
+
+    if (cur_chunk->m_next != nullptr && cur_chunk->m_next != m_heap_head) {
+        cur_chunk->m_next->m_prev = cur_chunk;
+    }
+    if (m_heap_tail == next_chunk) {
+        m_heap_tail = cur_chunk;
+    }
+    if (m_last_found == next_chunk) {
+        m_last_found = cur_chunk;
+    }
+    --m_total_chunks;
+
+    // the absorbed header must not look like a chunk anymore
+    next_chunk->m_size = 0;
+    next_chunk->m_used = true;
+
+    return cur_chunk;
+}
+
+/* absorbs a free successor and/or moves the break, the caller holds the heap */
+inline bool Heap::expandChunk(Chunk* user_chunk, const size_t n_bytes) {
+    Chunk* next_chunk = physicalNext(user_chunk);
+    bool next_is_free = next_chunk != nullptr && next_chunk->m_used == false;
+
+    size_t available_bytes = user_chunk->m_size;
+    Chunk* top_chunk = user_chunk;
+    if (next_is_free) {
+        available_bytes += allocationSize(next_chunk->m_size);
+        top_chunk = next_chunk;
+    }
+
+    // the break can be moved only if it still ends right behind us
+    bool at_break = top_chunk == m_heap_tail && top_chunk->m_segment_end &&
+                    (uint8_t*)top_chunk + allocationSize(top_chunk->m_size) ==
+                        currentBreak();
+
+    if (available_bytes < n_bytes && !at_break) {
+        return false;
+    }
+
+    if (available_bytes < n_bytes &&
+        moveBreak(n_bytes - available_bytes) == nullptr) {
+        return false;
+    }
+
+    if (next_is_free) {
+        detachFreeChunk(next_chunk);
+        user_chunk = coalesceChunk(user_chunk);
+    }
+    user_chunk->m_size = std::max(user_chunk->m_size, n_bytes);
+
+    // give the rest part back if it is worth a chunk
+    allocateFromList(user_chunk, n_bytes);
+    return true;
+}
+
+/* grows a free tail chunk up to n_bytes at the break, the caller holds the heap */
+inline Chunk* Heap::extendHeapTop(const size_t n_bytes) {
+    Chunk* tail_chunk = m_heap_tail;
+
+    if (tail_chunk == nullptr || tail_chunk->m_used ||
+        tail_chunk->m_size >= n_bytes) {
+        return nullptr;
+    }
+
+    if ((uint8_t*)tail_chunk + allocationSize(tail_chunk->m_size) !=
+        currentBreak()) {
+        return nullptr;
+    }
+
+    if (moveBreak(n_bytes - tail_chunk->m_size) == nullptr) {
+        return nullptr;
+    }
+
+    detachFreeChunk(tail_chunk);
+    tail_chunk->m_size = n_bytes;
+
+    return allocateFromList(tail_chunk, n_bytes);
+}
+
+inline Chunk* Heap::memFreeList(const size_t n_bytes) {
+    if (n_bytes <= 0) {
+        return nullptr;
+    }
+
+    Chunk* found_chunk = freeListFind(n_bytes);
+
+    // the coalescing put off by releaseChunk() happens now, in one pass, and
+    // only if merging can give enough bytes at all
+    if (found_chunk == nullptr && m_deferred_frees != 0 &&
+        m_free_list_bytes >= n_bytes) {
+        consolidateFreeChunks();
+        found_chunk = freeListFind(n_bytes);
+    }
+
+    if (found_chunk == nullptr) {
+        return nullptr;
+    }
+
+    freeListRemove(found_chunk);
+    return allocateFromList(found_chunk, n_bytes);
+}
+
+inline Chunk* Heap::memBestFit(const size_t n_bytes) {
+    if (n_bytes <= 0) {
+        return nullptr;
+    }
+
+    // lower bound by size: the smallest free chunk that still fits
+    Chunk* best_chunk = nullptr;
+    Chunk* current_chunk = m_size_index_root;
+
+    while (current_chunk != nullptr) {
+        countSearchStep();
+        SizeIndexNode* node = reinterpret_cast<SizeIndexNode*>(current_chunk->m_data);
+
+        if (current_chunk->m_size >= n_bytes) {
+            best_chunk = current_chunk;
+            current_chunk = node->m_left;
+        } else {
+            current_chunk = node->m_right;
+        }
+    }
+
+    if (best_chunk == nullptr) {
+        return nullptr;
+    }
+
+    indexRemove(best_chunk);
+    return allocateFromList(best_chunk, n_bytes);
+}
+
+inline void Heap::attachFreeChunk(Chunk* cur_chunk) {
+    switch (m_mem_mode) {
+        case MemoryManagement::free_list_search: {
+            freeListInsert(cur_chunk);
+            break;
+        }
+
+        case MemoryManagement::best_fit_search: {
+            indexInsert(cur_chunk);
+            break;
+        }
+
+        default: {
+            // first-fit and next-fit walk the chunk list itself
+            break;
+        }
+    }
+}
+
+inline void Heap::detachFreeChunk(Chunk* cur_chunk) {
+    switch (m_mem_mode) {
+        case MemoryManagement::free_list_search: {
+            freeListRemove(cur_chunk);
+            break;
+        }
+
+        case MemoryManagement::best_fit_search: {
+            indexRemove(cur_chunk);
+            break;
+        }
+
+        default: {
+            break;
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////
+/// Heap statistics and profiling
+////////////////////////////////////////////////////////////
+
+inline void Heap::countSearchStep() {
+    ++m_heap_stats.m_search_steps[static_cast<size_t>(m_mem_mode)];
+}
+
+inline size_t histogramBucket(size_t n_bytes) {
+    size_t bucket = 0;
+    while (n_bytes >>= 1) {
+        ++bucket;
+    }
+
+    return std::min(bucket, HEAP_HISTOGRAM_BUCKETS - 1);
+}
+
+/* the caller holds the heap */
+inline void Heap::recordLiveBytes(const Chunk* user_chunk, const ptrdiff_t delta) {
+    size_t& bytes = user_chunk->m_mapped ? m_heap_stats.m_bytes_mapped
+                                         : m_heap_stats.m_bytes_live;
+    bytes += delta;
+
+    m_heap_stats.m_bytes_peak =
+        std::max(m_heap_stats.m_bytes_peak,
+                 m_heap_stats.m_bytes_live + m_heap_stats.m_bytes_mapped);
+}
+
+/* the caller holds the heap */
+inline void Heap::recordAllocation(const Chunk* user_chunk) {
+    recordLiveBytes(user_chunk, user_chunk->m_size);
+
+    // m_sample_count is guarded by the heap like the rest of it
+    size_t sample_period = m_sample_period.load(std::memory_order_relaxed);
+    if (sample_period == 0 || ++m_sample_count < sample_period) {
+        return;
+    }
+    m_sample_count = 0;
+
+    recordSample(user_chunk);
+}
+
+inline void recordSample(const Chunk* user_chunk) {
+#ifdef ALLOC_THREAD_SAFE
+    std::lock_guard<std::mutex> samples_lock(m_samples_mutex);
+#endif  // ALLOC_THREAD_SAFE
+
+    AllocationSample& sample = m_samples[m_samples_taken++ % HEAP_SAMPLES];
+    sample.m_data = user_chunk->m_data;
+    sample.m_size = user_chunk->m_size;
+    sample.m_depth = backtrace(sample.m_frames, HEAP_SAMPLE_FRAMES);
+}
+
+inline void setSamplingPeriod(const size_t period) {
+    // glibc loads the unwinder (and mallocs) on the first backtrace call,
+    // do it here and not inside an allocation
+    void* warm_up_frame = nullptr;
+    backtrace(&warm_up_frame, 1);
+
+#ifdef ALLOC_THREAD_SAFE
+    std::lock_guard<std::mutex> samples_lock(m_samples_mutex);
+#endif  // ALLOC_THREAD_SAFE
+
+    m_sample_period.store(period, std::memory_order_relaxed);
+}
+
+inline HeapStats heapStats() {
+    return Heap::programHeap().stats();
+}
+
+inline void printHeapStats(FILE* stream) {
+    Heap::programHeap().printStats(stream);
+}
+
+inline void dumpHeap(FILE* stream) {
+    Heap::programHeap().dump(stream);
+}
+
+inline HeapStats Heap::stats() {
+#ifdef ALLOC_THREAD_SAFE
+    std::lock_guard<std::mutex> heap_lock(m_heap_mutex);
+#endif  // ALLOC_THREAD_SAFE
+
+    HeapStats stats = m_heap_stats;
+
+    for (Chunk* cur_chunk = m_heap_head; cur_chunk != nullptr;
+         cur_chunk = cur_chunk->m_next == m_heap_head ? nullptr
+                                                      : cur_chunk->m_next) {
+        size_t bucket = histogramBucket(cur_chunk->m_size);
+
+        if (cur_chunk->m_used) {
+            ++stats.m_chunks_used;
+            ++stats.m_used_histogram[bucket];
+            continue;
+        }
+
+        ++stats.m_chunks_free;
+        ++stats.m_free_histogram[bucket];
+        stats.m_bytes_free += cur_chunk->m_size;
+        stats.m_largest_free = std::max(stats.m_largest_free, cur_chunk->m_size);
+    }
+
+    stats.m_fragmentation =
+        stats.m_bytes_free == 0
+            ? 0.0
+            : 1.0 - (double)stats.m_largest_free / (double)stats.m_bytes_free;
+
+    return stats;
+}
+
+inline void Heap::printStats(FILE* stream) {
+    static const char* mode_names[MEMORY_MANAGEMENT_MODES] = {
+        "first_fit", "next_fit", "free_list", "best_fit"};
+
+    HeapStats stats = this->stats();
+
+    fprintf(stream,
+            "X17 heap: live %zu B, mapped %zu B, free %zu B, peak %zu B\n"
+            "  break: %zu B taken, peak %zu B\n"
+            "  chunks: %zu used, %zu free, largest free %zu B, "
+            "fragmentation %.3f\n",
+            stats.m_bytes_live, stats.m_bytes_mapped, stats.m_bytes_free,
+            stats.m_bytes_peak, stats.m_bytes_heap, stats.m_bytes_heap_peak,
+            stats.m_chunks_used, stats.m_chunks_free, stats.m_largest_free,
+            stats.m_fragmentation);
+
+    for (size_t mode_idx = 0; mode_idx < MEMORY_MANAGEMENT_MODES; ++mode_idx) {
+        if (stats.m_searches[mode_idx] == 0) {
+            continue;
+        }
+
+        fprintf(stream, "  %-9s: %zu searches, %.2f steps per search\n",
+                mode_names[mode_idx], stats.m_searches[mode_idx],
+                (double)stats.m_search_steps[mode_idx] /
+                    (double)stats.m_searches[mode_idx]);
+    }
+
+    fprintf(stream, "  size histogram (bytes >= 2^i: used / free):\n");
+    for (size_t bucket = 0; bucket < HEAP_HISTOGRAM_BUCKETS; ++bucket) {
+        if (stats.m_used_histogram[bucket] == 0 &&
+            stats.m_free_histogram[bucket] == 0) {
+            continue;
+        }
+
+        fprintf(stream, "    2^%-2zu: %zu / %zu\n", bucket,
+                stats.m_used_histogram[bucket], stats.m_free_histogram[bucket]);
+    }
+}
+
+inline void Heap::dump(FILE* stream) {
+#ifdef ALLOC_THREAD_SAFE
+    std::lock_guard<std::mutex> heap_lock(m_heap_mutex);
+#endif  // ALLOC_THREAD_SAFE
+
+    for (Chunk* cur_chunk = m_heap_head; cur_chunk != nullptr;
+         cur_chunk = cur_chunk->m_next == m_heap_head ? nullptr
+                                                      : cur_chunk->m_next) {
+        fprintf(stream, "%p: %10zu B %s%s%s\n", (void*)cur_chunk,
+                cur_chunk->m_size, cur_chunk->m_used ? "used" : "free",
+                cur_chunk->m_prev_used ? "" : " prev-free",
+                cur_chunk->m_segment_end ? " segment-end" : "");
+    }
+}
+
+inline void dumpSamples(FILE* stream) {
+#ifdef ALLOC_THREAD_SAFE
+    std::lock_guard<std::mutex> samples_lock(m_samples_mutex);
+#endif  // ALLOC_THREAD_SAFE
+
+    size_t samples_kept = std::min(m_samples_taken, HEAP_SAMPLES);
+
+    for (size_t sample_idx = 0; sample_idx < samples_kept; ++sample_idx) {
+        const AllocationSample& sample = m_samples[sample_idx];
+
+        fprintf(stream, "sample %p (%zu B):\n", (const void*)sample.m_data,
+                sample.m_size);
+        fflush(stream);
+
+        // writes straight to the descriptor, no malloc involved
+        backtrace_symbols_fd(sample.m_frames, sample.m_depth, fileno(stream));
+    }
+}
+
+////////////////////////////////////////////////////////////
+/// Allocation traces
+////////////////////////////////////////////////////////////
+
+inline uint64_t traceClock() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+/* the caller holds the trace */
+inline void flushTrace() {
+    size_t written_bytes = 0;
+
+    while (written_bytes < m_trace_length) {
+        ssize_t result = write(m_trace_fd, m_trace_buffer + written_bytes,
+                               m_trace_length - written_bytes);
+        if (result <= 0) {
+            break;
+        }
+
+        written_bytes += result;
+    }
+
+    m_trace_length = 0;
+}
+
+inline void traceVarint(uint64_t value) {
+    while (value >= 0x80) {
+        m_trace_buffer[m_trace_length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+
+    m_trace_buffer[m_trace_length++] = (uint8_t)value;
+}
+
+inline void traceCall(const TraceOp op, const data_t* data_ptr, const size_t n_bytes,
+                      const uint64_t extra) {
+    if (!m_tracing.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    // failed allocations and null frees leave nothing to replay
+    if (data_ptr == nullptr && op != TraceOp::reallocate) {
+        return;
+    }
+
+#ifdef ALLOC_THREAD_SAFE
+    std::lock_guard<std::mutex> trace_lock(m_trace_mutex);
+#endif  // ALLOC_THREAD_SAFE
+
+    if (m_trace_fd < 0) {
+        return;
+    }
+
+    if (m_trace_length + TRACE_RECORD_MAX_BYTES > TRACE_BUFFER_BYTES) {
+        flushTrace();
+    }
+
+    uint64_t now = traceClock();
+
+    m_trace_buffer[m_trace_length++] = static_cast<uint8_t>(op);
+    traceVarint(now - m_trace_last);
+    traceVarint(reinterpret_cast<uintptr_t>(data_ptr));
+    traceVarint(n_bytes);
+
+    if (op == TraceOp::reallocate || op == TraceOp::allocate_aligned) {
+        traceVarint(extra);
+    }
+
+    m_trace_last = now;
+}
+
+/* records every call of the program heap into path until stopTrace() */
+inline bool startTrace(const char* path) {
+    stopTrace();
+
+    int trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (trace_fd < 0) {
+        return false;
+    }
+
+    if (write(trace_fd, TRACE_MAGIC, sizeof(TRACE_MAGIC)) !=
+        (ssize_t)sizeof(TRACE_MAGIC)) {
+        close(trace_fd);
+        return false;
+    }
+
+    {
+#ifdef ALLOC_THREAD_SAFE
+        std::lock_guard<std::mutex> trace_lock(m_trace_mutex);
+#endif  // ALLOC_THREAD_SAFE
+
+        m_trace_fd = trace_fd;
+        m_trace_last = traceClock();
+        m_trace_length = 0;
+    }
+
+    // a trace that is never stopped is still complete at exit
+    static bool stop_at_exit = atexit(stopTrace) == 0;
+    (void)stop_at_exit;
+
+    m_tracing.store(true);
+    return true;
+}
+
+inline void stopTrace() {
+    m_tracing.store(false);
+
+#ifdef ALLOC_THREAD_SAFE
+    std::lock_guard<std::mutex> trace_lock(m_trace_mutex);
+#endif  // ALLOC_THREAD_SAFE
+
+    if (m_trace_fd < 0) {
+        return;
+    }
+
+    flushTrace();
+    close(m_trace_fd);
+    m_trace_fd = -1;
+}
+
+inline bool readTraceHeader(FILE* stream) {
+    char magic[sizeof(TRACE_MAGIC)];
+
+    return fread(magic, 1, sizeof(magic), stream) == sizeof(magic) &&
+           memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0;
+}
+
+inline bool readTraceVarint(FILE* stream, uint64_t& value) {
+    value = 0;
+
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        int byte = fgetc(stream);
+        if (byte == EOF) {
+            return false;
+        }
+
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* record keeps the timestamp of the previous record, the deltas add up */
+inline bool readTraceRecord(FILE* stream, TraceRecord& record) {
+    int op = fgetc(stream);
+    if (op == EOF || op > static_cast<int>(TraceOp::try_expand)) {
+        return false;
+    }
+
+    uint64_t delta = 0;
+    record.m_op = static_cast<TraceOp>(op);
+    record.m_old_id = 0;
+    record.m_alignment = 0;
+
+    if (!readTraceVarint(stream, delta) || !readTraceVarint(stream, record.m_id) ||
+        !readTraceVarint(stream, record.m_size)) {
+        return false;
+    }
+    record.m_timestamp += delta;
+
+    if (record.m_op == TraceOp::reallocate) {
+        return readTraceVarint(stream, record.m_old_id);
+    }
+    if (record.m_op == TraceOp::allocate_aligned) {
+        return readTraceVarint(stream, record.m_alignment);
+    }
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////
+/// Best-fit size index (treap keyed by m_size, then address)
+////////////////////////////////////////////////////////////
+
+inline SizeIndexNode* indexNode(const Chunk* cur_chunk) {
+    return reinterpret_cast<SizeIndexNode*>(
+        const_cast<data_t*>(cur_chunk->m_data));
+}
+
+inline bool indexLess(const Chunk* lhs, const Chunk* rhs) {
+    if (lhs->m_size != rhs->m_size) {
+        return lhs->m_size < rhs->m_size;
+    }
+
+    return lhs < rhs;
+}
+
+inline size_t indexPriority(const Chunk* cur_chunk) {
+    // fibonacci hashing spreads neighbouring addresses over the whole range
+    return static_cast<size_t>(reinterpret_cast<uintptr_t>(cur_chunk) *
+                               UINT64_C(11400714819323198485));
+}
+
+// every key in lhs must be less than every key in rhs
+inline Chunk* indexMerge(Chunk* lhs, Chunk* rhs) {
+    if (lhs == nullptr) {
+        return rhs;
+    }
+    if (rhs == nullptr) {
+        return lhs;
+    }
+
+    if (indexPriority(lhs) > indexPriority(rhs)) {
+        indexNode(lhs)->m_right = indexMerge(indexNode(lhs)->m_right, rhs);
+        return lhs;
+    }
+
+    indexNode(rhs)->m_left = indexMerge(lhs, indexNode(rhs)->m_left);
+    return rhs;
+}
+
+// lhs gets keys less than key_chunk, rhs gets the rest
+inline void indexSplit(Chunk* root, const Chunk* key_chunk, Chunk*& lhs, Chunk*& rhs) {
+    if (root == nullptr) {
+        lhs = rhs = nullptr;
+        return;
+    }
+
+    if (indexLess(root, key_chunk)) {
+        indexSplit(indexNode(root)->m_right, key_chunk, indexNode(root)->m_right,
+                   rhs);
+        lhs = root;
+    } else {
+        indexSplit(indexNode(root)->m_left, key_chunk, lhs,
+                   indexNode(root)->m_left);
+        rhs = root;
+    }
+}
+
+inline void Heap::indexInsert(Chunk* cur_chunk) {
+    indexNode(cur_chunk)->m_left = nullptr;
+    indexNode(cur_chunk)->m_right = nullptr;
+
+    Chunk* lhs = nullptr;
+    Chunk* rhs = nullptr;
+    indexSplit(m_size_index_root, cur_chunk, lhs, rhs);
+
+    m_size_index_root = indexMerge(indexMerge(lhs, cur_chunk), rhs);
+}
+
+inline void Heap::indexRemove(Chunk* cur_chunk) {
+    Chunk** link = &m_size_index_root;
+
+    while (*link != nullptr && *link != cur_chunk) {
+        link = indexLess(cur_chunk, *link) ? &indexNode(*link)->m_left
+                                           : &indexNode(*link)->m_right;
+    }
+
+    if (*link == nullptr) {
+        // chunk is not indexed (e.g. it was free before best-fit was chosen)
+        return;
+    }
+
+    *link = indexMerge(indexNode(cur_chunk)->m_left,
+                       indexNode(cur_chunk)->m_right);
+}
+
+////////////////////////////////////////////////////////////
+/// Free-list bins (intrusive, address-ordered, deferred coalescing)
+////////////////////////////////////////////////////////////
+
+inline FreeListNode* freeListNode(const Chunk* cur_chunk) {
+    return reinterpret_cast<FreeListNode*>(const_cast<data_t*>(cur_chunk->m_data));
+}
+
+// monotonic in n_bytes: every chunk of a higher bin is bigger
+inline size_t freeListBin(const size_t n_bytes) {
+    if (n_bytes < FREE_LIST_SMALL_BINS * FREE_LIST_STEP) {
+        return n_bytes / FREE_LIST_STEP;
+    }
+
+    size_t log_bytes = 63 - __builtin_clzll(n_bytes);
+    size_t split = (n_bytes >> (log_bytes - FREE_LIST_SPLITS_LOG)) &
+                   (((size_t)1 << FREE_LIST_SPLITS_LOG) - 1);
+
+    return FREE_LIST_SMALL_BINS +
+           ((log_bytes - FREE_LIST_SMALL_LOG) << FREE_LIST_SPLITS_LOG) + split;
+}
+
+inline void Heap::freeListInsert(Chunk* cur_chunk) {
+    size_t bin = freeListBin(cur_chunk->m_size);
+
+    // walk back from the tail: chunks from the top of the heap go last
+    Chunk* next_chunk = nullptr;
+    Chunk* prev_chunk = m_bin_tails[bin];
+    while (prev_chunk != nullptr && prev_chunk > cur_chunk) {
+        next_chunk = prev_chunk;
+        prev_chunk = freeListNode(prev_chunk)->m_prev_free;
+    }
+
+    freeListNode(cur_chunk)->m_prev_free = prev_chunk;
+    freeListNode(cur_chunk)->m_next_free = next_chunk;
+
+    (prev_chunk != nullptr ? freeListNode(prev_chunk)->m_next_free
+                           : m_bin_heads[bin]) = cur_chunk;
+    (next_chunk != nullptr ? freeListNode(next_chunk)->m_prev_free
+                           : m_bin_tails[bin]) = cur_chunk;
+
+    m_bin_map[bin / 64] |= (uint64_t)1 << (bin % 64);
+    m_free_list_bytes += cur_chunk->m_size;
+}
+
+inline void Heap::freeListRemove(Chunk* cur_chunk) {
+    size_t bin = freeListBin(cur_chunk->m_size);
+
+    Chunk* prev_chunk = freeListNode(cur_chunk)->m_prev_free;
+    Chunk* next_chunk = freeListNode(cur_chunk)->m_next_free;
+
+    (prev_chunk != nullptr ? freeListNode(prev_chunk)->m_next_free
+                           : m_bin_heads[bin]) = next_chunk;
+    (next_chunk != nullptr ? freeListNode(next_chunk)->m_prev_free
+                           : m_bin_tails[bin]) = prev_chunk;
+
+    if (m_bin_heads[bin] == nullptr) {
+        m_bin_map[bin / 64] &= ~((uint64_t)1 << (bin % 64));
+    }
+    m_free_list_bytes -= cur_chunk->m_size;
+}
+
+inline Chunk* Heap::freeListFind(const size_t n_bytes) {
+    size_t bin = freeListBin(n_bytes);
+
+    // the own bin may hold smaller chunks, first fit in address order
+    for (Chunk* cur_chunk = m_bin_heads[bin]; cur_chunk != nullptr;
+         cur_chunk = freeListNode(cur_chunk)->m_next_free) {
+        countSearchStep();
+        if (cur_chunk->m_size >= n_bytes) {
+            return cur_chunk;
+        }
+    }
+
+    // any chunk of a higher bin fits: the lowest one of the smallest bin
+    for (size_t word = (bin + 1) / 64; word < FREE_LIST_MAP_WORDS; ++word) {
+        uint64_t bits = m_bin_map[word];
+        if (word == (bin + 1) / 64) {
+            bits &= ~(uint64_t)0 << ((bin + 1) % 64);
+        }
+
+        if (bits != 0) {
+            countSearchStep();
+            return m_bin_heads[word * 64 + __builtin_ctzll(bits)];
+        }
+    }
+
+    return nullptr;
+}
+
+/* merges every run of free neighbours and refills the bins in address order */
+inline void Heap::consolidateFreeChunks() {
+    std::fill(m_bin_heads, m_bin_heads + FREE_LIST_BINS, nullptr);
+    std::fill(m_bin_tails, m_bin_tails + FREE_LIST_BINS, nullptr);
+    std::fill(m_bin_map, m_bin_map + FREE_LIST_MAP_WORDS, 0);
+    m_free_list_bytes = 0;
+    m_deferred_frees = 0;
+
+    // the chunk list is in address order, so every insert is an append
+    for (Chunk* cur_chunk = m_heap_head; cur_chunk != nullptr;
+         cur_chunk = cur_chunk->m_next == m_heap_head ? nullptr
+                                                      : cur_chunk->m_next) {
+        countSearchStep();
+        if (cur_chunk->m_used) {
+            continue;
+        }
+
+        bool merged = false;
+        while (isCoalesceableNext(cur_chunk)) {
+            coalesceChunk(cur_chunk);
+            merged = true;
+        }
+
+        chunkFooter(cur_chunk) = cur_chunk->m_size;
+        freeListInsert(cur_chunk);
+
+        if (merged && cur_chunk != m_heap_tail) {
+            releaseFreePages(cur_chunk);
+        }
+    }
+
+    if (m_heap_tail != nullptr && !m_heap_tail->m_used) {
+        trimHeapTop(m_heap_tail);
+    }
+}
+
+#ifdef ALLOC_THREAD_SAFE
+////////////////////////////////////////////////////////////
+/// Per-thread caches (ALLOC_THREAD_SAFE)
+////////////////////////////////////////////////////////////
+
+/* a cached chunk links to the next one through its payload, copied in and
+ * out so the payload is never read as a Chunk* */
+inline Chunk* cacheNext(const Chunk* cur_chunk) {
+    Chunk* next_chunk;
+    std::memcpy(&next_chunk, cur_chunk->m_data, sizeof(next_chunk));
+    return next_chunk;
+}
+
+inline void setCacheNext(Chunk* cur_chunk, Chunk* next_chunk) {
+    std::memcpy(cur_chunk->m_data, &next_chunk, sizeof(next_chunk));
+}
+
+inline size_t cacheClass(const size_t n_bytes) {
+    // floor: a chunk of class k always holds at least (k + 1) * STEP bytes
+    return std::min(n_bytes, THREAD_CACHE_MAX_BYTES) / THREAD_CACHE_CLASS_STEP -
+           1;
+}
+
+inline void dropThreadCache(ThreadCache* cache) {
+    for (size_t class_idx = 0; class_idx < THREAD_CACHE_CLASSES; ++class_idx) {
+        cache->m_bins[class_idx] = nullptr;
+        cache->m_bin_length[class_idx] = 0;
+    }
+
+    cache->m_remote_frees.store(nullptr);
+    cache->m_outbox_owner = nullptr;
+    cache->m_outbox_head = cache->m_outbox_tail = nullptr;
+    cache->m_outbox_length = 0;
+
+    cache->m_generation = m_heap_generation.load();
+}
+
+inline ThreadCache* threadCache() {
+    ThreadCache* cache = m_thread_cache.m_cache;
+
+    if (cache == nullptr) {
+        std::lock_guard<std::mutex> caches_lock(m_caches_mutex);
+
+        for (ThreadCache* dead = m_caches; dead != nullptr;
+             dead = dead->m_next_cache) {
+            if (dead->m_alive.load() == false) {
+                cache = dead;
+                break;
+            }
+        }
+
+        if (cache == nullptr) {
+            // straight from the OS: the cache must outlive any heap
+            // generation, and malloc may be this heap (see malloc_shim.cpp)
+            void* cache_memory = mmap(nullptr, sizeof(ThreadCache),
+                                      PROT_READ | PROT_WRITE,
+                                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (cache_memory == MAP_FAILED) {
+                return nullptr;
+            }
+
+            cache = new (cache_memory) ThreadCache();
+            dropThreadCache(cache);
+
+            cache->m_next_cache = m_caches;
+            m_caches = cache;
+        }
+
+        cache->m_alive.store(true);
+        m_thread_cache.m_cache = cache;
+    }
+
+    if (cache->m_generation != m_heap_generation.load(std::memory_order_relaxed)) {
+        dropThreadCache(cache);
+    }
+
+    return cache;
+}
+
+/* returns the chunks past DEPOT_DEPTH to the heap, takes its own locks */
+inline void depotPush(const size_t class_idx, Chunk* head, Chunk* tail,
+                      const size_t length) {
+    DepotBin& depot_bin = m_depot[class_idx];
+    Chunk* overflow = nullptr;
+
+    {
+        std::lock_guard<std::mutex> depot_lock(depot_bin.m_mutex);
+
+        setCacheNext(tail, depot_bin.m_head);
+        depot_bin.m_head = head;
+        depot_bin.m_length += length;
+
+        if (depot_bin.m_length > DEPOT_DEPTH) {
+            overflow = depot_bin.m_head;
+            depot_bin.m_head = nullptr;
+            depot_bin.m_length = 0;
+        }
+    }
+
+    if (overflow == nullptr) {
+        return;
+    }
+
+    Heap& heap = Heap::programHeap();
+
+    std::lock_guard<std::mutex> heap_lock(heap.m_heap_mutex);
+    while (overflow != nullptr) {
+        Chunk* cur_chunk = overflow;
+        overflow = cacheNext(cur_chunk);
+
+        heap.releaseChunk(cur_chunk);
+    }
+}
+
+inline void flushOutbox(ThreadCache* cache) {
+    if (cache->m_outbox_head == nullptr) {
+        return;
+    }
+
+    ThreadCache* owner = cache->m_outbox_owner;
+
+    if (owner->m_alive.load()) {
+        // one CAS hands the whole batch over
+        Chunk* remote_head = owner->m_remote_frees.load();
+        do {
+            setCacheNext(cache->m_outbox_tail, remote_head);
+        } while (!owner->m_remote_frees.compare_exchange_weak(
+            remote_head, cache->m_outbox_head));
+    } else {
+        while (cache->m_outbox_head != nullptr) {
+            Chunk* cur_chunk = cache->m_outbox_head;
+            cache->m_outbox_head = cacheNext(cur_chunk);
+
+            cur_chunk->m_owner = nullptr;
+            depotPush(cacheClass(cur_chunk->m_size), cur_chunk, cur_chunk, 1);
+        }
+    }
+
+    cache->m_outbox_owner = nullptr;
+    cache->m_outbox_head = cache->m_outbox_tail = nullptr;
+    cache->m_outbox_length = 0;
+}
+
+inline void cachePush(ThreadCache* cache, Chunk* user_chunk) {
+    size_t class_idx = cacheClass(user_chunk->m_size);
+
+    user_chunk->m_owner = cache;
+    setCacheNext(user_chunk, cache->m_bins[class_idx]);
+    cache->m_bins[class_idx] = user_chunk;
+
+    if (++cache->m_bin_length[class_idx] <= THREAD_CACHE_DEPTH) {
+        return;
+    }
+
+    // hand the oldest part of the bin over to the depot
+    Chunk* batch_tail = cache->m_bins[class_idx];
+    for (size_t chunk_idx = 1; chunk_idx < THREAD_CACHE_DEPTH - THREAD_CACHE_BATCH;
+         ++chunk_idx) {
+        batch_tail = cacheNext(batch_tail);
+    }
+
+    Chunk* batch_head = cacheNext(batch_tail);
+    setCacheNext(batch_tail, nullptr);
+
+    size_t batch_length =
+        cache->m_bin_length[class_idx] - (THREAD_CACHE_DEPTH - THREAD_CACHE_BATCH);
+    cache->m_bin_length[class_idx] = THREAD_CACHE_DEPTH - THREAD_CACHE_BATCH;
+
+    batch_tail = batch_head;
+    while (cacheNext(batch_tail) != nullptr) {
+        batch_tail = cacheNext(batch_tail);
+    }
+
+    depotPush(class_idx, batch_head, batch_tail, batch_length);
+}
+
+inline void drainRemoteFrees(ThreadCache* cache) {
+    Chunk* remote_head = cache->m_remote_frees.exchange(nullptr);
+
+    while (remote_head != nullptr) {
+        Chunk* cur_chunk = remote_head;
+        remote_head = cacheNext(cur_chunk);
+
+        cachePush(cache, cur_chunk);
+    }
+}
+
+inline data_t* cacheAllocate(const size_t n_aligned_bytes) {
+    ThreadCache* cache = threadCache();
+    size_t class_idx = cacheClass(n_aligned_bytes);
+
+    if (cache == nullptr) {
+        return nullptr;
+    }
+
+    if (cache->m_bins[class_idx] == nullptr) {
+        drainRemoteFrees(cache);
+    }
+
+    if (cache->m_bins[class_idx] == nullptr) {
+        DepotBin& depot_bin = m_depot[class_idx];
+        std::lock_guard<std::mutex> depot_lock(depot_bin.m_mutex);
+
+        // refill with up to one batch
+        for (size_t chunk_idx = 0;
+             chunk_idx < THREAD_CACHE_BATCH && depot_bin.m_head != nullptr;
+             ++chunk_idx) {
+            Chunk* cur_chunk = depot_bin.m_head;
+            depot_bin.m_head = cacheNext(cur_chunk);
+            --depot_bin.m_length;
+
+            setCacheNext(cur_chunk, cache->m_bins[class_idx]);
+            cache->m_bins[class_idx] = cur_chunk;
+            ++cache->m_bin_length[class_idx];
+        }
+    }
+
+    Chunk* cached_chunk = cache->m_bins[class_idx];
+    if (cached_chunk == nullptr) {
+        return nullptr;
+    }
+
+    cache->m_bins[class_idx] = cacheNext(cached_chunk);
+    --cache->m_bin_length[class_idx];
+
+    cached_chunk->m_owner = cache;
+    return cached_chunk->m_data;
+}
+
+inline bool cacheDeallocate(Chunk* user_chunk) {
+    if (user_chunk->m_size < THREAD_CACHE_CLASS_STEP ||
+        user_chunk->m_size > THREAD_CACHE_MAX_BYTES) {
+        return false;
+    }
+
+    ThreadCache* cache = threadCache();
+    ThreadCache* owner = user_chunk->m_owner;
+
+    if (cache == nullptr) {
+        return false;
+    }
+
+    if (owner == cache || owner == nullptr) {
+        cachePush(cache, user_chunk);
+        return true;
+    }
+
+    // cross-thread free: batch it up for the owner
+    if (cache->m_outbox_owner != owner) {
+        flushOutbox(cache);
+        cache->m_outbox_owner = owner;
+    }
+
+    setCacheNext(user_chunk, cache->m_outbox_head);
+    if (cache->m_outbox_head == nullptr) {
+        cache->m_outbox_tail = user_chunk;
+    }
+    cache->m_outbox_head = user_chunk;
+
+    if (++cache->m_outbox_length >= THREAD_CACHE_BATCH) {
+        flushOutbox(cache);
+    }
+
+    return true;
+}
+
+inline ThreadCacheHandle::~ThreadCacheHandle() {
+    if (m_cache == nullptr) {
+        return;
+    }
+
+    // the chunks of a stale cache went down with the heap, it is only
+    // emptied and left for the next thread to adopt
+    if (m_cache->m_generation != m_heap_generation.load()) {
+        dropThreadCache(m_cache);
+        m_cache->m_alive.store(false);
+        return;
+    }
+
+    flushOutbox(m_cache);
+    drainRemoteFrees(m_cache);
+
+    // everything cached goes to the depot for the other threads
+    for (size_t class_idx = 0; class_idx < THREAD_CACHE_CLASSES; ++class_idx) {
+        while (m_cache->m_bins[class_idx] != nullptr) {
+            Chunk* cur_chunk = m_cache->m_bins[class_idx];
+            m_cache->m_bins[class_idx] = cacheNext(cur_chunk);
+
+            cur_chunk->m_owner = nullptr;
+            depotPush(class_idx, cur_chunk, cur_chunk, 1);
+        }
+        m_cache->m_bin_length[class_idx] = 0;
+    }
+
+    m_cache->m_alive.store(false);
+}
+#endif  // ALLOC_THREAD_SAFE
+
+////////////////////////////////////////////////////////////
+/// STL-compatible allocator over the generic heap
+////////////////////////////////////////////////////////////
+
+template <typename T>
+class GenericAllocator {
+   public:
+    /* TYPEDEFS */
+    typedef T value_type;
+    typedef T* pointer;
+    typedef std::size_t size_type;
+    /* END OF TYPEDEFS */
+
+   public:
+    GenericAllocator() = default;
+
+    // allocates from heap instead of the program heap
+    explicit GenericAllocator(Heap& heap) : m_heap(&heap) {}
+
+    template <typename U>
+    GenericAllocator(const GenericAllocator<U>& other) : m_heap(other.m_heap) {}
+
+    pointer allocate(size_type cnt) {
+        data_t* data = m_heap != nullptr ? m_heap->allocate(cnt * sizeof(T))
+                                         : X17::allocate(cnt * sizeof(T));
+        return reinterpret_cast<pointer>(data);
+    }
+
+    void deallocate(pointer ptr, size_type) {
+        if (m_heap != nullptr) {
+            m_heap->deallocate(reinterpret_cast<data_t*>(ptr));
+        } else {
+            X17::deallocate(reinterpret_cast<data_t*>(ptr));
+        }
+    }
+
+    // alignment must be a power of two, deallocate() frees the block
+    pointer allocate_aligned(size_type cnt, size_type alignment) {
+        data_t* data = m_heap != nullptr
+                           ? m_heap->allocateAligned(cnt * sizeof(T), alignment)
+                           : X17::allocateAligned(cnt * sizeof(T), alignment);
+        return reinterpret_cast<pointer>(data);
+    }
+
+    // lets containers grow their buffer without moving the elements
+    bool try_expand(pointer ptr, size_type, size_type new_cnt) {
+        data_t* data = reinterpret_cast<data_t*>(ptr);
+        return m_heap != nullptr ? m_heap->tryExpand(data, new_cnt * sizeof(T))
+                                 : X17::tryExpand(data, new_cnt * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const GenericAllocator<U>& other) const {
+        return m_heap == other.m_heap;
+    }
+
+    template <typename U>
+    bool operator!=(const GenericAllocator<U>& other) const {
+        return m_heap != other.m_heap;
+    }
+
+   private:
+    template <typename U>
+    friend class GenericAllocator;
+
+    // nullptr: the program heap through the free functions
+    Heap* m_heap{nullptr};
+};
+
+/* std::pmr adapter, a resource per heap for std::pmr containers and
+ * polymorphic_allocator */
+class HeapResource : public std::pmr::memory_resource {
+   public:
+    HeapResource() = default;
+
+    // allocates from heap instead of the program heap
+    explicit HeapResource(Heap& heap) : m_heap(&heap) {}
+
+   private:
+    void* do_allocate(size_t n_bytes, size_t alignment) override {
+        // pmr may ask for 0 bytes and wants a distinct pointer back
+        n_bytes = std::max(n_bytes, (size_t)1);
+
+        data_t* data = m_heap != nullptr ? m_heap->allocateAligned(n_bytes, alignment)
+                                         : X17::allocateAligned(n_bytes, alignment);
+        if (data == nullptr) {
+            throw std::bad_alloc();
+        }
+
+        return data;
+    }
+
+    void do_deallocate(void* mem_ptr, size_t, size_t) override {
+        if (m_heap != nullptr) {
+            m_heap->deallocate(reinterpret_cast<data_t*>(mem_ptr));
+        } else {
+            X17::deallocate(reinterpret_cast<data_t*>(mem_ptr));
+        }
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        const HeapResource* other_heap = dynamic_cast<const HeapResource*>(&other);
+        return other_heap != nullptr && other_heap->m_heap == m_heap;
+    }
+
+   private:
+    // nullptr: the program heap through the free functions
+    Heap* m_heap{nullptr};
+};
+
 };  // namespace X17
 
 #endif  // !X17_GENERIC_ALLOC
\ No newline at end of file
@@ -0,0 +1,423 @@
+////////////////////////////////////////////////////////////
+/// Headers
+////////////////////////////////////////////////////////////
+#include <malloc.h>
+#include <pthread.h>
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// the binaries this is preloaded into are multi-threaded and expect blocks
+// aligned for any type
+#ifndef ALLOC_THREAD_SAFE
+#define ALLOC_THREAD_SAFE
+#endif  // !ALLOC_THREAD_SAFE
+#ifndef ALLOC_MAX_ALIGN
+#define ALLOC_MAX_ALIGN
+#endif  // !ALLOC_MAX_ALIGN
+
+#include "generic_alloc.hpp"
+#include "../pool/pool_alloc_nonstl.hpp"
+
+/* runs unmodified binaries on the X17 allocators: malloc and friends are
+ * served by the program heap, requests up to SLAB_MAX_BYTES by the pools of
+ * an X17::SlabAllocator:
+ *
+ *     g++ -std=c++17 -O2 -fPIC -shared -fvisibility=hidden malloc_shim.cpp \
+ *         -o libx17malloc.so
+ *     LD_PRELOAD=./libx17malloc.so ./app
+ *
+ * read from the environment at the first call:
+ *     X17_MALLOC_MODE=first_fit|next_fit|free_list|best_fit  (best_fit)
+ *     X17_MALLOC_STATS=1      heap and pool stats on stderr at exit
+ *     X17_MALLOC_TRACE=path   record every call, see trace_replay.cpp
+ */
+
+#define SHIM_EXPORT extern "C" __attribute__((visibility("default")))
+
+using namespace X17;
+
+static const size_t MALLOC_ALIGNMENT = CHUNK_ALIGNMENT;
+
+static const size_t SHIM_CHUNKS_PER_BLOCK = 256;
+
+// every slab class carves its blocks from an address range of its own, so
+// free() tells a pool chunk and its class from the address alone
+static const size_t SHIM_CLASS_REGION = 256 * 1024 * 1024;
+
+void* poolBlock(const size_t n_bytes);
+
+struct ShimClass {
+    std::mutex m_mutex;
+
+    // next block of the class region
+    uint8_t* m_break{nullptr};
+
+    size_t m_chunks_live{0};
+    size_t m_chunks_peak{0};
+    size_t m_blocks{0};
+};
+
+// built by shimSetup(): malloc may run before any constructor of this
+// library, and free() still runs after its destructors. Blocks are carved
+// from the class regions and never released
+alignas(SlabAllocator) static uint8_t m_slab_storage[sizeof(SlabAllocator)];
+static SlabAllocator* m_slab;
+static ShimClass m_classes[SLAB_CLASSES];
+static uint8_t* m_pool_region;
+
+static std::atomic<bool> m_shim_ready;
+static bool m_shim_stats;
+
+////////////////////////////////////////////////////////////
+/// Pools
+////////////////////////////////////////////////////////////
+
+inline bool isPoolChunk(const void* mem_ptr) {
+    return (uintptr_t)mem_ptr - (uintptr_t)m_pool_region <
+           SLAB_CLASSES * SHIM_CLASS_REGION;
+}
+
+inline size_t poolClassOf(const void* mem_ptr) {
+    return ((uint8_t*)mem_ptr - m_pool_region) / SHIM_CLASS_REGION;
+}
+
+/* slab block source, called under the class mutex. The class is known from
+ * the block size */
+void* poolBlock(const size_t n_bytes) {
+    size_t class_idx = SlabAllocator::sizeClass(n_bytes / SHIM_CHUNKS_PER_BLOCK);
+    ShimClass& pool_class = m_classes[class_idx];
+
+    uint8_t* region_end = m_pool_region + (class_idx + 1) * SHIM_CLASS_REGION;
+    if (m_pool_region == nullptr || pool_class.m_break + n_bytes > region_end) {
+        // the class region is used up, its requests go to the heap
+        return nullptr;
+    }
+
+    void* block = pool_class.m_break;
+    pool_class.m_break += n_bytes;
+    ++pool_class.m_blocks;
+
+    return block;
+}
+
+void* poolAllocate(const size_t n_bytes) {
+    // classes of a multiple of MALLOC_ALIGNMENT hand out aligned chunks
+    size_t n_aligned_bytes =
+        (std::max(n_bytes, (size_t)1) + MALLOC_ALIGNMENT - 1) & ~(MALLOC_ALIGNMENT - 1);
+    size_t class_idx = SlabAllocator::sizeClass(n_aligned_bytes);
+    ShimClass& pool_class = m_classes[class_idx];
+
+    std::lock_guard<std::mutex> pool_lock(pool_class.m_mutex);
+
+    void* chunk = m_slab->allocate(n_aligned_bytes);
+    if (chunk != nullptr) {
+        pool_class.m_chunks_peak =
+            std::max(pool_class.m_chunks_peak, ++pool_class.m_chunks_live);
+    }
+
+    return chunk;
+}
+
+void poolDeallocate(void* mem_ptr) {
+    size_t class_idx = poolClassOf(mem_ptr);
+    ShimClass& pool_class = m_classes[class_idx];
+
+    std::lock_guard<std::mutex> pool_lock(pool_class.m_mutex);
+
+    m_slab->deallocate(mem_ptr, SlabAllocator::classBytes(class_idx));
+    --pool_class.m_chunks_live;
+}
+
+////////////////////////////////////////////////////////////
+/// Setup
+////////////////////////////////////////////////////////////
+
+/* a forked child gets every lock in the state it had in the parent, so none
+ * may be held across fork() */
+void shimForkPrepare() {
+    for (ShimClass& pool_class : m_classes) {
+        pool_class.m_mutex.lock();
+    }
+
+    m_caches_mutex.lock();
+    for (DepotBin& depot_bin : m_depot) {
+        depot_bin.m_mutex.lock();
+    }
+    Heap::programHeap().m_heap_mutex.lock();
+    m_samples_mutex.lock();
+    m_trace_mutex.lock();
+}
+
+void shimForkRelease() {
+    m_trace_mutex.unlock();
+    m_samples_mutex.unlock();
+    Heap::programHeap().m_heap_mutex.unlock();
+    for (DepotBin& depot_bin : m_depot) {
+        depot_bin.m_mutex.unlock();
+    }
+    m_caches_mutex.unlock();
+
+    for (ShimClass& pool_class : m_classes) {
+        pool_class.m_mutex.unlock();
+    }
+}
+
+/* the first call comes before main() and before any other thread exists */
+void shimSetup() {
+    static const char* mode_names[MEMORY_MANAGEMENT_MODES] = {
+        "first_fit", "next_fit", "free_list", "best_fit"};
+
+    MemoryManagement search_mode = MemoryManagement::best_fit_search;
+
+    m_slab = new (m_slab_storage)
+        SlabAllocator(SHIM_CHUNKS_PER_BLOCK, poolBlock, nullptr);
+
+    if (const char* mode_name = getenv("X17_MALLOC_MODE")) {
+        for (size_t mode_idx = 0; mode_idx < MEMORY_MANAGEMENT_MODES; ++mode_idx) {
+            if (strcmp(mode_name, mode_names[mode_idx]) == 0) {
+                search_mode = static_cast<MemoryManagement>(mode_idx);
+            }
+        }
+    }
+
+    // nothing is allocated yet, configure() may drop the heap
+    configure(search_mode);
+
+    // only address space is reserved, pages come with the blocks
+    void* region = mmap(nullptr, SLAB_CLASSES * SHIM_CLASS_REGION,
+                        PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (region != MAP_FAILED) {
+        m_pool_region = reinterpret_cast<uint8_t*>(region);
+
+        for (size_t class_idx = 0; class_idx < SLAB_CLASSES; ++class_idx) {
+            m_classes[class_idx].m_break = m_pool_region + class_idx * SHIM_CLASS_REGION;
+        }
+    }
+
+    pthread_atfork(shimForkPrepare, shimForkRelease, shimForkRelease);
+
+    const char* stats = getenv("X17_MALLOC_STATS");
+    m_shim_stats = stats != nullptr && stats[0] != '\0' && stats[0] != '0';
+
+    if (const char* trace_path = getenv("X17_MALLOC_TRACE")) {
+        startTrace(trace_path);
+    }
+}
+
+inline void shimInit() {
+    if (!m_shim_ready.load(std::memory_order_acquire)) {
+        // set first: the setup itself may call malloc
+        m_shim_ready.store(true, std::memory_order_release);
+        shimSetup();
+    }
+}
+
+__attribute__((destructor)) void shimStats() {
+    if (!m_shim_stats) {
+        return;
+    }
+
+    printHeapStats(stderr);
+
+    fprintf(stderr, "X17 pools:\n");
+    for (size_t class_idx = 0; class_idx < SLAB_CLASSES; ++class_idx) {
+        ShimClass& pool_class = m_classes[class_idx];
+        std::lock_guard<std::mutex> pool_lock(pool_class.m_mutex);
+
+        if (pool_class.m_blocks == 0) {
+            continue;
+        }
+
+        size_t class_bytes = SlabAllocator::classBytes(class_idx);
+        fprintf(stderr, "  %4zu B: %zu live, peak %zu, %zu blocks (%zu B)\n",
+                class_bytes, pool_class.m_chunks_live, pool_class.m_chunks_peak,
+                pool_class.m_blocks,
+                pool_class.m_blocks * SHIM_CHUNKS_PER_BLOCK * class_bytes);
+    }
+}
+
+////////////////////////////////////////////////////////////
+/// Shim
+////////////////////////////////////////////////////////////
+
+void* shimAllocate(const size_t n_bytes) {
+    shimInit();
+
+    if (n_bytes <= SLAB_MAX_BYTES) {
+        if (void* chunk = poolAllocate(n_bytes)) {
+            traceCall(TraceOp::allocate, (data_t*)chunk, n_bytes);
+            return chunk;
+        }
+    }
+
+    void* data = allocate(n_bytes);
+    if (data == nullptr) {
+        errno = ENOMEM;
+    }
+
+    return data;
+}
+
+void* shimAllocateAligned(const size_t n_bytes, const size_t alignment) {
+    if (alignment <= MALLOC_ALIGNMENT) {
+        return shimAllocate(n_bytes);
+    }
+
+    // pool chunks sit behind the header of their block, only
+    // MALLOC_ALIGNMENT is promised for them whatever their class
+    shimInit();
+
+    void* data = allocateAligned(std::max(n_bytes, (size_t)1), alignment);
+    if (data == nullptr) {
+        errno = ENOMEM;
+    }
+
+    assert(((uintptr_t)data & (alignment - 1)) == 0);
+    return data;
+}
+
+void shimDeallocate(void* mem_ptr) {
+    if (mem_ptr == nullptr) {
+        return;
+    }
+
+    if (isPoolChunk(mem_ptr)) {
+        traceCall(TraceOp::deallocate, (data_t*)mem_ptr, 0);
+        poolDeallocate(mem_ptr);
+        return;
+    }
+
+    deallocate(reinterpret_cast<data_t*>(mem_ptr));
+}
+
+size_t shimUsableSize(void* mem_ptr) {
+    if (mem_ptr == nullptr) {
+        return 0;
+    }
+
+    if (isPoolChunk(mem_ptr)) {
+        return SlabAllocator::classBytes(poolClassOf(mem_ptr));
+    }
+
+    return shiftToHeader(reinterpret_cast<data_t*>(mem_ptr))->m_size;
+}
+
+void* shimReallocate(void* mem_ptr, const size_t n_bytes) {
+    if (mem_ptr == nullptr) {
+        return shimAllocate(n_bytes);
+    }
+
+    if (n_bytes == 0) {
+        shimDeallocate(mem_ptr);
+        return nullptr;
+    }
+
+    size_t old_bytes = shimUsableSize(mem_ptr);
+
+    if (isPoolChunk(mem_ptr) ? n_bytes <= old_bytes
+                             : tryExpand(reinterpret_cast<data_t*>(mem_ptr), n_bytes)) {
+        return mem_ptr;
+    }
+
+    void* new_data = shimAllocate(n_bytes);
+    if (new_data == nullptr) {
+        return nullptr;
+    }
+
+    memcpy(new_data, mem_ptr, std::min(old_bytes, n_bytes));
+    shimDeallocate(mem_ptr);
+
+    return new_data;
+}
+
+////////////////////////////////////////////////////////////
+/// Exported symbols
+////////////////////////////////////////////////////////////
+
+SHIM_EXPORT void* malloc(size_t n_bytes) noexcept {
+    return shimAllocate(n_bytes);
+}
+
+SHIM_EXPORT void free(void* mem_ptr) noexcept {
+    shimDeallocate(mem_ptr);
+}
+
+SHIM_EXPORT void* calloc(size_t count, size_t n_bytes) noexcept {
+    size_t total_bytes = 0;
+    if (__builtin_mul_overflow(count, n_bytes, &total_bytes)) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+
+    void* data = shimAllocate(total_bytes);
+    if (data != nullptr) {
+        memset(data, 0, total_bytes);
+    }
+
+    return data;
+}
+
+SHIM_EXPORT void* realloc(void* mem_ptr, size_t n_bytes) noexcept {
+    return shimReallocate(mem_ptr, n_bytes);
+}
+
+SHIM_EXPORT void* reallocarray(void* mem_ptr, size_t count, size_t n_bytes) noexcept {
+    size_t total_bytes = 0;
+    if (__builtin_mul_overflow(count, n_bytes, &total_bytes)) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+
+    return shimReallocate(mem_ptr, total_bytes);
+}
+
+SHIM_EXPORT int posix_memalign(void** mem_ptr, size_t alignment, size_t n_bytes) noexcept {
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+
+    void* data = shimAllocateAligned(n_bytes, alignment);
+    if (data == nullptr) {
+        return ENOMEM;
+    }
+
+    *mem_ptr = data;
+    return 0;
+}
+
+SHIM_EXPORT void* aligned_alloc(size_t alignment, size_t n_bytes) noexcept {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return nullptr;
+    }
+
+    return shimAllocateAligned(n_bytes, alignment);
+}
+
+SHIM_EXPORT void* memalign(size_t alignment, size_t n_bytes) noexcept {
+    // glibc rounds a bad alignment up to the next power of two
+    size_t power_alignment = MALLOC_ALIGNMENT;
+    while (power_alignment < alignment) {
+        power_alignment <<= 1;
+    }
+
+    return shimAllocateAligned(n_bytes, power_alignment);
+}
+
+SHIM_EXPORT void* valloc(size_t n_bytes) noexcept {
+    return shimAllocateAligned(n_bytes, pageSize());
+}
+
+SHIM_EXPORT void* pvalloc(size_t n_bytes) noexcept {
+    return shimAllocateAligned((n_bytes + pageSize() - 1) & ~(pageSize() - 1),
+                               pageSize());
+}
+
+SHIM_EXPORT size_t malloc_usable_size(void* mem_ptr) noexcept {
+    return shimUsableSize(mem_ptr);
+}
@@ -0,0 +1,429 @@
+////////////////////////////////////////////////////////////
+/// Headers
+////////////////////////////////////////////////////////////
+#include <malloc.h>
+#include <chrono>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include "generic_alloc.hpp"
+
+/* replays a trace recorded with X17::startTrace() against every
+ * MemoryManagement mode (each on a local Heap) and against malloc:
+ *
+ *     g++ -std=c++17 -O2 -DALLOC_NOEXCEPT trace_replay.cpp -o trace_replay
+ *     ./trace_replay app.trace
+ */
+
+using namespace X17;
+
+// footprint and fragmentation are sampled every FOOTPRINT_SAMPLE_OPS ops
+static const size_t FOOTPRINT_SAMPLE_OPS = 1024;
+static const uint32_t NO_SLOT = UINT32_MAX;
+
+// a traced call with its block ids turned into slots of a block table
+struct ReplayOp {
+    TraceOp m_op;
+    uint32_t m_slot;
+    size_t m_size;
+    size_t m_alignment;
+};
+
+struct ReplayTrace {
+    std::vector<ReplayOp> m_ops;
+    size_t m_slots;
+    size_t m_peak_requested;
+};
+
+struct ReplayResult {
+    double m_ops_per_second;
+    uint64_t m_latency[5];  // p50, p90, p99, p99.9, max in ns
+
+    size_t m_peak_footprint;
+    double m_free_share;     // mean free part of the footprint
+    double m_fragmentation;  // mean X17 fragmentation, < 0 if unknown
+    size_t m_failures;
+};
+
+class HeapBackend {
+   public:
+    HeapBackend(MemoryManagement search_mode, const size_t region_bytes)
+        : m_heap(search_mode, region_bytes) {}
+
+    void* allocate(const size_t n_bytes) { return m_heap.allocate(n_bytes); }
+
+    void* allocateAligned(const size_t n_bytes, const size_t alignment) {
+        return m_heap.allocateAligned(n_bytes, alignment);
+    }
+
+    void deallocate(void* block) { m_heap.deallocate((data_t*)block); }
+
+    void* reallocate(void* block, const size_t n_bytes) {
+        return m_heap.reallocate((data_t*)block, n_bytes);
+    }
+
+    bool tryExpand(void* block, const size_t n_bytes) {
+        return m_heap.tryExpand((data_t*)block, n_bytes);
+    }
+
+    void sample(size_t& footprint, double& free_share, double& fragmentation) {
+        HeapStats stats = m_heap.stats();
+
+        footprint = stats.m_bytes_heap_peak;
+        free_share = stats.m_bytes_heap == 0
+                         ? 0.0
+                         : (double)stats.m_bytes_free / (double)stats.m_bytes_heap;
+        fragmentation = stats.m_fragmentation;
+    }
+
+   private:
+    Heap m_heap;
+};
+
+class MallocBackend {
+   public:
+    // the replay's own tables live in malloc as well, they are not part of
+    // the footprint (free space malloc already had is)
+    MallocBackend() {
+        struct mallinfo2 info = mallinfo2();
+        m_baseline = info.uordblks + info.hblkhd;
+    }
+
+    void* allocate(const size_t n_bytes) { return malloc(n_bytes); }
+
+    void* allocateAligned(const size_t n_bytes, const size_t alignment) {
+        void* block = nullptr;
+        return posix_memalign(&block, alignment, n_bytes) == 0 ? block : nullptr;
+    }
+
+    void deallocate(void* block) { free(block); }
+
+    void* reallocate(void* block, const size_t n_bytes) {
+        return realloc(block, n_bytes);
+    }
+
+    bool tryExpand(void* block, const size_t n_bytes) {
+        // malloc cannot grow in place on request, only report the slack
+        return malloc_usable_size(block) >= n_bytes;
+    }
+
+    void sample(size_t& footprint, double& free_share, double& fragmentation) {
+        struct mallinfo2 info = mallinfo2();
+        size_t current = info.arena + info.hblkhd;
+
+        // malloc has no peak of its own, the sampled maximum has to do
+        if (current > m_baseline) {
+            m_peak_footprint = std::max(m_peak_footprint, current - m_baseline);
+        }
+        footprint = m_peak_footprint;
+        free_share = info.arena == 0 ? 0.0 : (double)info.fordblks / (double)info.arena;
+        fragmentation = -1.0;
+    }
+
+   private:
+    size_t m_baseline;
+    size_t m_peak_footprint{0};
+};
+
+bool loadTrace(const char* path, ReplayTrace& trace) {
+    FILE* stream = fopen(path, "rb");
+    if (stream == nullptr || !readTraceHeader(stream)) {
+        fprintf(stderr, "%s is not an X17 trace\n", path);
+        if (stream != nullptr) {
+            fclose(stream);
+        }
+
+        return false;
+    }
+
+    std::unordered_map<uint64_t, uint32_t> live_slots;
+    std::vector<uint32_t> free_slots;
+    std::vector<size_t> slot_bytes;
+    size_t requested_bytes = 0;
+
+    trace.m_slots = 0;
+    trace.m_peak_requested = 0;
+
+    auto takeSlot = [&](const uint64_t id, const size_t n_bytes) {
+        uint32_t slot = 0;
+        if (free_slots.empty()) {
+            slot = trace.m_slots++;
+            slot_bytes.push_back(0);
+        } else {
+            slot = free_slots.back();
+            free_slots.pop_back();
+        }
+
+        live_slots[id] = slot;
+        slot_bytes[slot] = n_bytes;
+        requested_bytes += n_bytes;
+        trace.m_peak_requested = std::max(trace.m_peak_requested, requested_bytes);
+
+        return slot;
+    };
+
+    auto findSlot = [&](const uint64_t id) {
+        auto found = live_slots.find(id);
+        return found == live_slots.end() ? NO_SLOT : found->second;
+    };
+
+    auto dropSlot = [&](const uint64_t id, const uint32_t slot) {
+        live_slots.erase(id);
+        free_slots.push_back(slot);
+        requested_bytes -= slot_bytes[slot];
+    };
+
+    TraceRecord record{};
+    while (readTraceRecord(stream, record)) {
+        switch (record.m_op) {
+            case TraceOp::allocate:
+            case TraceOp::allocate_aligned: {
+                if (findSlot(record.m_id) != NO_SLOT) {
+                    // freed by a call the trace missed
+                    trace.m_ops.push_back(ReplayOp{TraceOp::deallocate,
+                                                   findSlot(record.m_id), 0, 0});
+                    dropSlot(record.m_id, findSlot(record.m_id));
+                }
+
+                uint32_t slot = takeSlot(record.m_id, record.m_size);
+                trace.m_ops.push_back(
+                    ReplayOp{record.m_op, slot, record.m_size, record.m_alignment});
+                break;
+            }
+
+            case TraceOp::deallocate: {
+                // blocks from before the trace started are unknown
+                uint32_t slot = findSlot(record.m_id);
+                if (slot != NO_SLOT) {
+                    trace.m_ops.push_back(ReplayOp{TraceOp::deallocate, slot, 0, 0});
+                    dropSlot(record.m_id, slot);
+                }
+                break;
+            }
+
+            case TraceOp::try_expand: {
+                uint32_t slot = findSlot(record.m_id);
+                if (slot != NO_SLOT) {
+                    trace.m_ops.push_back(
+                        ReplayOp{TraceOp::try_expand, slot, record.m_size, 0});
+                }
+                break;
+            }
+
+            case TraceOp::reallocate: {
+                uint32_t slot = findSlot(record.m_old_id);
+
+                if (record.m_id == 0) {
+                    // reallocate(ptr, 0) frees, a failed one changes nothing
+                    if (record.m_size == 0 && slot != NO_SLOT) {
+                        trace.m_ops.push_back(
+                            ReplayOp{TraceOp::deallocate, slot, 0, 0});
+                        dropSlot(record.m_old_id, slot);
+                    }
+                    break;
+                }
+
+                if (slot == NO_SLOT) {
+                    trace.m_ops.push_back(ReplayOp{
+                        TraceOp::allocate, takeSlot(record.m_id, record.m_size),
+                        record.m_size, 0});
+                    break;
+                }
+
+                // the block keeps its slot under the new id
+                live_slots.erase(record.m_old_id);
+                live_slots[record.m_id] = slot;
+                requested_bytes += record.m_size - slot_bytes[slot];
+                slot_bytes[slot] = record.m_size;
+                trace.m_peak_requested =
+                    std::max(trace.m_peak_requested, requested_bytes);
+
+                trace.m_ops.push_back(
+                    ReplayOp{TraceOp::reallocate, slot, record.m_size, 0});
+                break;
+            }
+        }
+    }
+
+    fclose(stream);
+    return true;
+}
+
+template <typename Backend>
+inline bool replayOp(Backend& backend, const ReplayOp& op, std::vector<void*>& blocks) {
+    void*& block = blocks[op.m_slot];
+
+    switch (op.m_op) {
+        case TraceOp::allocate: {
+            block = backend.allocate(op.m_size);
+            break;
+        }
+
+        case TraceOp::allocate_aligned: {
+            block = backend.allocateAligned(op.m_size, op.m_alignment);
+            break;
+        }
+
+        case TraceOp::deallocate: {
+            backend.deallocate(block);
+            block = nullptr;
+            return true;
+        }
+
+        case TraceOp::reallocate: {
+            block = backend.reallocate(block, op.m_size);
+            break;
+        }
+
+        case TraceOp::try_expand: {
+            backend.tryExpand(block, op.m_size);
+            return true;
+        }
+    }
+
+    if (block == nullptr) {
+        return false;
+    }
+
+    // the first touch of fresh pages is part of the cost
+    *(volatile char*)block = 0;
+    return true;
+}
+
+template <typename Backend>
+void releaseBlocks(Backend& backend, std::vector<void*>& blocks) {
+    for (void*& block : blocks) {
+        if (block != nullptr) {
+            backend.deallocate(block);
+            block = nullptr;
+        }
+    }
+}
+
+/* one pass for throughput, a second one timing every op and sampling the
+ * footprint in between */
+template <typename Backend, typename... Args>
+ReplayResult replay(const ReplayTrace& trace, Args... backend_args) {
+    using clock = std::chrono::steady_clock;
+
+    ReplayResult result{};
+    std::vector<void*> blocks(trace.m_slots, nullptr);
+
+    {
+        Backend backend(backend_args...);
+
+        clock::time_point begin = clock::now();
+        for (const ReplayOp& op : trace.m_ops) {
+            replayOp(backend, op, blocks);
+        }
+        clock::time_point end = clock::now();
+
+        result.m_ops_per_second =
+            trace.m_ops.size() / std::chrono::duration<double>(end - begin).count();
+        releaseBlocks(backend, blocks);
+    }
+
+    std::vector<uint64_t> latencies(trace.m_ops.size());
+    double free_share_sum = 0.0;
+    double fragmentation_sum = 0.0;
+    size_t samples = 0;
+
+    Backend backend(backend_args...);
+
+    for (size_t op_idx = 0; op_idx < trace.m_ops.size(); ++op_idx) {
+        clock::time_point begin = clock::now();
+        bool succeeded = replayOp(backend, trace.m_ops[op_idx], blocks);
+        clock::time_point end = clock::now();
+
+        latencies[op_idx] =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+        result.m_failures += succeeded ? 0 : 1;
+
+        if ((op_idx + 1) % FOOTPRINT_SAMPLE_OPS == 0 ||
+            op_idx + 1 == trace.m_ops.size()) {
+            double free_share = 0.0;
+            double fragmentation = 0.0;
+
+            backend.sample(result.m_peak_footprint, free_share, fragmentation);
+            free_share_sum += free_share;
+            fragmentation_sum += fragmentation;
+            ++samples;
+        }
+    }
+
+    releaseBlocks(backend, blocks);
+
+    result.m_free_share = samples == 0 ? 0.0 : free_share_sum / samples;
+    result.m_fragmentation = samples == 0 ? 0.0 : fragmentation_sum / samples;
+
+    if (!latencies.empty()) {
+        std::sort(latencies.begin(), latencies.end());
+
+        const double quantiles[4] = {0.5, 0.9, 0.99, 0.999};
+        for (size_t quantile_idx = 0; quantile_idx < 4; ++quantile_idx) {
+            result.m_latency[quantile_idx] =
+                latencies[(size_t)(quantiles[quantile_idx] * (latencies.size() - 1))];
+        }
+        result.m_latency[4] = latencies.back();
+    }
+
+    return result;
+}
+
+void printResult(const char* name, const ReplayResult& result) {
+    fprintf(stdout, "%-10s %8.2f %8lu %8lu %8lu %8lu %10lu %10zu %7.1f%%", name,
+            result.m_ops_per_second / 1e6, (unsigned long)result.m_latency[0],
+            (unsigned long)result.m_latency[1], (unsigned long)result.m_latency[2],
+            (unsigned long)result.m_latency[3], (unsigned long)result.m_latency[4],
+            result.m_peak_footprint / 1024, result.m_free_share * 100.0);
+
+    if (result.m_fragmentation < 0.0) {
+        fprintf(stdout, "      -");
+    } else {
+        fprintf(stdout, " %6.3f", result.m_fragmentation);
+    }
+
+    if (result.m_failures != 0) {
+        fprintf(stdout, "  (%zu failed)", result.m_failures);
+    }
+    fprintf(stdout, "\n");
+}
+
+int main(int argc, char** argv) {
+    static const char* mode_names[MEMORY_MANAGEMENT_MODES] = {
+        "first_fit", "next_fit", "free_list", "best_fit"};
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <trace> [heap region MiB]\n", argv[0]);
+        return 1;
+    }
+
+    ReplayTrace trace;
+    if (!loadTrace(argv[1], trace)) {
+        return 1;
+    }
+
+    // room for the peak with every chunk header and alignment lead
+    size_t region_bytes = argc > 2 ? (size_t)atol(argv[2]) << 20
+                                   : trace.m_peak_requested * 4 + (64 << 20);
+
+    fprintf(stdout, "%s: %zu ops, %zu blocks, peak requested %zu KiB\n\n", argv[1],
+            trace.m_ops.size(), trace.m_slots, trace.m_peak_requested / 1024);
+    fprintf(stdout, "%-10s %8s %8s %8s %8s %8s %10s %10s %8s %6s\n", "backend",
+            "Mops/s", "p50 ns", "p90 ns", "p99 ns", "p99.9 ns", "max ns",
+            "peak KiB", "free", "frag");
+
+    for (size_t mode_idx = 0; mode_idx < MEMORY_MANAGEMENT_MODES; ++mode_idx) {
+        printResult(mode_names[mode_idx],
+                    replay<HeapBackend>(trace, (MemoryManagement)mode_idx,
+                                        region_bytes));
+    }
+
+    // last: malloc is never reset, its state carries over between passes
+    printResult("malloc", replay<MallocBackend>(trace));
+
+    return 0;
+}
@@ -2,15 +2,40 @@
 
 // ---------------------------------------------------------
 
-/* uncomment this line for enabling DEBUG mode */
+/* uncomment this line for enabling DEBUG mode: MemPool counters and event
+ * log, as with POOL_TELEMETRY_EVENTS */
 // #define POOL_ALLOC_DEBUG
 
+/* uncomment these lines for MemPool telemetry: POOL_TELEMETRY keeps per-pool
+ * counters (MemPool::stats()), POOL_TELEMETRY_EVENTS also records every call
+ * in a ring a background thread writes to alloc_logs/mempool.events */
+// #define POOL_TELEMETRY
+// #define POOL_TELEMETRY_EVENTS
+
 // ---------------------------------------------------------
 
 /* set chunks-per-block value for allocator */
 /* comment this line to enable default mode */
 /* default mode : 1024 chunks per block*/
+/* for MemPool this is the largest block: its blocks start at
+ * POOL_INITIAL_CHUNKS chunks and double up to it */
 #define DEFAULT_CHUNKS_PER_BLOCK 1024
+#define POOL_INITIAL_CHUNKS 32
+
+// ---------------------------------------------------------
+
+/* uncomment this line to make the free lists of MemPool and the non-STL
+ * PoolAllocator lock-free, so one pool can be shared by threads */
+// #define POOL_LOCK_FREE
+
+// ---------------------------------------------------------
+
+/* uncomment these lines to map pool blocks (ObjectPools of MemPool) straight
+ * from the OS: POOL_HUGE_PAGES backs them with 2 MB huge pages, hugetlb or
+ * transparent ones, POOL_PREFAULT faults all their pages in when they are
+ * mapped. A block takes whole pages, so chunks per block should fill them */
+// #define POOL_HUGE_PAGES
+// #define POOL_PREFAULT
 
 // ---------------------------------------------------------
 
@@ -0,0 +1,94 @@
+#ifndef X17_LOCK_FREE_STACK
+#define X17_LOCK_FREE_STACK
+
+////////////////////////////////////////////////////////////
+/// Headers
+////////////////////////////////////////////////////////////
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace X17 {
+
+// shared heads sit on cache lines of their own
+static const size_t CACHE_LINE_BYTES = 64;
+
+/* Treiber stack of free chunks linked through Node::m_next (POOL_LOCK_FREE).
+ * The head packs the top chunk with a tag bumped by every push and pop, so a
+ * pop whose top was popped and pushed again meanwhile (ABA) fails its CAS.
+ * Popped chunks must stay mapped: a racing pop may still read their m_next */
+template <typename Node>
+class TaggedStack {
+    // user-space addresses fit in 48 bits, the upper 16 bits hold the tag
+    static const int POINTER_BITS = 48;
+    static const uint64_t POINTER_MASK = ((uint64_t)1 << POINTER_BITS) - 1;
+
+   public:
+    constexpr TaggedStack() = default;
+
+    TaggedStack(const TaggedStack& other) = delete;
+    TaggedStack& operator=(const TaggedStack& other) = delete;
+
+    Node* pop() {
+        uint64_t head = m_head.load(std::memory_order_acquire);
+
+        while (Node* top = pointerOf(head)) {
+            // top may be taken and reused by now, the CAS tells
+            Node* next = top->m_next;
+
+            if (m_head.compare_exchange_weak(head, pack(next, head),
+                                             std::memory_order_acquire,
+                                             std::memory_order_acquire)) {
+                return top;
+            }
+        }
+
+        return nullptr;
+    }
+
+    void push(Node* node) { pushChain(node, node); }
+
+    /* pushes first..last (already linked) with one CAS */
+    void pushChain(Node* first, Node* last) {
+        uint64_t head = m_head.load(std::memory_order_relaxed);
+
+        do {
+            last->m_next = pointerOf(head);
+        } while (!m_head.compare_exchange_weak(head, pack(first, head),
+                                               std::memory_order_release,
+                                               std::memory_order_relaxed));
+    }
+
+    /* takes the whole list at once */
+    Node* popAll() {
+        uint64_t head = m_head.load(std::memory_order_relaxed);
+
+        while (!m_head.compare_exchange_weak(head, pack(nullptr, head),
+                                             std::memory_order_acquire,
+                                             std::memory_order_relaxed)) {
+        }
+
+        return pointerOf(head);
+    }
+
+    bool empty() const {
+        return pointerOf(m_head.load(std::memory_order_relaxed)) == nullptr;
+    }
+
+   private:
+    static Node* pointerOf(const uint64_t head) {
+        return reinterpret_cast<Node*>(head & POINTER_MASK);
+    }
+
+    static uint64_t pack(const Node* node, const uint64_t old_head) {
+        uint64_t tag = (old_head >> POINTER_BITS) + 1;
+        return reinterpret_cast<uintptr_t>(node) | (tag << POINTER_BITS);
+    }
+
+   private:
+    alignas(CACHE_LINE_BYTES) std::atomic<uint64_t> m_head{0};
+};
+
+};  // namespace X17
+
+#endif  // !X17_LOCK_FREE_STACK
@@ -0,0 +1,320 @@
+#ifndef X17_MAGAZINE_CACHE
+#define X17_MAGAZINE_CACHE
+
+////////////////////////////////////////////////////////////
+/// Headers
+////////////////////////////////////////////////////////////
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+
+namespace X17 {
+
+// chunks in a full magazine
+static const size_t MAGAZINE_ROUNDS = 32;
+// full magazines kept by a depot, the chunks of any further one go back to
+// the pool, so memory freed by one thread and never reused stays bounded
+static const size_t DEPOT_MAGAZINES = 16;
+// a depot takes any of the THREAD_MAGAZINE_WAYS slots of the set its address
+// picks, so a thread keeps up to SETS * WAYS depots and only depots beyond
+// the ways of one set evict each other
+static const size_t THREAD_MAGAZINE_SETS = 16;
+static const size_t THREAD_MAGAZINE_WAYS = 4;
+
+// LIFO stack of chunks linked through their first word
+struct Magazine {
+    void* m_head;
+    size_t m_rounds;
+};
+
+class MagazineDepot;
+
+// one thread's magazines for one depot. m_previous is always full or empty
+struct MagazineSlot {
+    MagazineDepot* m_depot;
+    Magazine m_loaded;
+    Magazine m_previous;
+
+    // other slots bound to the same depot
+    MagazineSlot* m_next_slot;
+};
+
+struct ThreadMagazines {
+    MagazineSlot m_slots[THREAD_MAGAZINE_SETS][THREAD_MAGAZINE_WAYS];
+    // way of each set the next depot takes once the set is full
+    size_t m_next_victim[THREAD_MAGAZINE_SETS];
+
+    ~ThreadMagazines();
+};
+
+// guards binding slots to depots and the slot lists of the depots. Both are
+// inline, so every translation unit shares one mutex and one set of slots
+inline std::mutex m_magazine_mutex;
+inline thread_local ThreadMagazines m_thread_magazines;
+
+inline void*& magazineLink(void* chunk) {
+    return *reinterpret_cast<void**>(chunk);
+}
+
+/* shared exchange of whole magazines between the threads of one pool. Lock
+ * order is m_magazine_mutex, then m_depot_mutex */
+class MagazineDepot {
+   public:
+    /* DEPOTS ARE BOUND TO THREAD SLOTS, COPY AND MOVE ARE PROHIBITED */
+    MagazineDepot(const MagazineDepot& other) = delete;
+    MagazineDepot& operator=(const MagazineDepot& other) = delete;
+
+    /* hands the magazines of a slot back, m_magazine_mutex is held */
+    void unbindSlot(MagazineSlot& slot);
+
+    /* returns the full magazines of the depot to the pool, so that a trim()
+     * of the pool can release their blocks */
+    void drainDepot();
+
+   protected:
+    MagazineDepot() = default;
+    ~MagazineDepot() = default;
+
+    MagazineSlot& threadSlot();
+
+    /* fills an empty magazine from the depot or else from the pool, false
+     * if the pool is out of memory */
+    bool exchangeEmpty(Magazine& magazine);
+    /* takes a magazine, leaves it empty */
+    void exchangeFull(Magazine& magazine);
+
+    /* forgets the slots and the depot, the pool is about to go */
+    void dropSlots();
+
+    // the pool behind the depot, called with m_depot_mutex held
+    virtual void* poolAllocate() = 0;
+    virtual void poolDeallocate(void* chunk) = 0;
+
+   private:
+    MagazineSlot& bindSlot(MagazineSlot* set, size_t& next_victim);
+
+   private:
+    std::mutex m_depot_mutex;
+    Magazine m_full[DEPOT_MAGAZINES]{};
+    size_t m_full_count{0};
+
+    MagazineSlot* m_slots{nullptr};
+};
+
+/* per-thread magazines in front of a shared pool: allocate() and
+ * deallocate() take no lock until a thread's two magazines run empty or
+ * full, then one magazine is exchanged with the depot whole. A chunk freed
+ * on another thread than it was allocated on goes to the depot with the
+ * magazine it was freed into. The pool itself needs no lock of its own.
+ *
+ * Pool is PoolAllocator or MemPool, reached through chunkAllocate() and
+ * chunkDeallocate() of its header */
+template <typename Pool>
+class MagazineCache : private MagazineDepot {
+   public:
+    MagazineCache(Pool& pool, const size_t chunk_bytes)
+        : m_pool(pool), m_chunk_bytes(chunk_bytes) {}
+
+    ~MagazineCache() { dropSlots(); }
+
+    using MagazineDepot::drainDepot;
+
+    void* allocate();
+    void deallocate(void* chunk);
+
+   private:
+    void* poolAllocate() override { return chunkAllocate(m_pool, m_chunk_bytes); }
+
+    void poolDeallocate(void* chunk) override {
+        chunkDeallocate(m_pool, chunk, m_chunk_bytes);
+    }
+
+   private:
+    Pool& m_pool;
+    size_t m_chunk_bytes;
+};
+
+template <typename Pool>
+void* MagazineCache<Pool>::allocate() {
+    MagazineSlot& slot = threadSlot();
+
+    if (slot.m_loaded.m_rounds == 0) {
+        if (slot.m_previous.m_rounds != 0) {
+            std::swap(slot.m_loaded, slot.m_previous);
+        } else if (!exchangeEmpty(slot.m_loaded)) {
+            return nullptr;
+        }
+    }
+
+    void* chunk = slot.m_loaded.m_head;
+    slot.m_loaded.m_head = magazineLink(chunk);
+    --slot.m_loaded.m_rounds;
+
+    return chunk;
+}
+
+template <typename Pool>
+void MagazineCache<Pool>::deallocate(void* chunk) {
+    if (chunk == nullptr) {
+        return;
+    }
+
+    MagazineSlot& slot = threadSlot();
+
+    if (slot.m_loaded.m_rounds >= MAGAZINE_ROUNDS) {
+        if (slot.m_previous.m_rounds != 0) {
+            exchangeFull(slot.m_previous);
+        }
+
+        std::swap(slot.m_loaded, slot.m_previous);
+    }
+
+    magazineLink(chunk) = slot.m_loaded.m_head;
+    slot.m_loaded.m_head = chunk;
+    ++slot.m_loaded.m_rounds;
+}
+
+inline MagazineSlot& MagazineDepot::threadSlot() {
+    // depots are far more than 64 bytes apart
+    size_t set_idx = (reinterpret_cast<uintptr_t>(this) >> 6) % THREAD_MAGAZINE_SETS;
+    MagazineSlot* set = m_thread_magazines.m_slots[set_idx];
+
+    for (size_t way = 0; way < THREAD_MAGAZINE_WAYS; ++way) {
+        if (set[way].m_depot == this) {
+            return set[way];
+        }
+    }
+
+    return bindSlot(set, m_thread_magazines.m_next_victim[set_idx]);
+}
+
+inline MagazineSlot& MagazineDepot::bindSlot(MagazineSlot* set, size_t& next_victim) {
+    std::lock_guard<std::mutex> magazine_lock(m_magazine_mutex);
+
+    // a free way if there is one, otherwise the ways take turns
+    MagazineSlot* slot = nullptr;
+    for (size_t way = 0; way < THREAD_MAGAZINE_WAYS; ++way) {
+        if (set[way].m_depot == nullptr) {
+            slot = &set[way];
+            break;
+        }
+    }
+
+    if (slot == nullptr) {
+        slot = &set[next_victim];
+        next_victim = (next_victim + 1) % THREAD_MAGAZINE_WAYS;
+
+        slot->m_depot->unbindSlot(*slot);
+    }
+
+    slot->m_depot = this;
+    slot->m_next_slot = m_slots;
+    m_slots = slot;
+
+    return *slot;
+}
+
+inline void MagazineDepot::unbindSlot(MagazineSlot& slot) {
+    exchangeFull(slot.m_loaded);
+    exchangeFull(slot.m_previous);
+
+    MagazineSlot** link = &m_slots;
+    while (*link != &slot) {
+        link = &(*link)->m_next_slot;
+    }
+    *link = slot.m_next_slot;
+
+    slot.m_depot = nullptr;
+    slot.m_next_slot = nullptr;
+}
+
+inline bool MagazineDepot::exchangeEmpty(Magazine& magazine) {
+    std::lock_guard<std::mutex> depot_lock(m_depot_mutex);
+
+    if (m_full_count != 0) {
+        magazine = m_full[--m_full_count];
+        return true;
+    }
+
+    while (magazine.m_rounds < MAGAZINE_ROUNDS) {
+        void* chunk = poolAllocate();
+        if (chunk == nullptr) {
+            break;
+        }
+
+        magazineLink(chunk) = magazine.m_head;
+        magazine.m_head = chunk;
+        ++magazine.m_rounds;
+    }
+
+    return magazine.m_rounds != 0;
+}
+
+inline void MagazineDepot::exchangeFull(Magazine& magazine) {
+    if (magazine.m_rounds == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> depot_lock(m_depot_mutex);
+
+    if (m_full_count < DEPOT_MAGAZINES) {
+        m_full[m_full_count++] = magazine;
+    } else {
+        while (magazine.m_head != nullptr) {
+            void* chunk = magazine.m_head;
+            magazine.m_head = magazineLink(chunk);
+
+            poolDeallocate(chunk);
+        }
+    }
+
+    magazine = Magazine{};
+}
+
+inline void MagazineDepot::drainDepot() {
+    std::lock_guard<std::mutex> depot_lock(m_depot_mutex);
+
+    while (m_full_count != 0) {
+        Magazine& magazine = m_full[--m_full_count];
+
+        while (magazine.m_head != nullptr) {
+            void* chunk = magazine.m_head;
+            magazine.m_head = magazineLink(chunk);
+
+            poolDeallocate(chunk);
+        }
+
+        magazine = Magazine{};
+    }
+}
+
+inline void MagazineDepot::dropSlots() {
+    std::lock_guard<std::mutex> magazine_lock(m_magazine_mutex);
+
+    // the chunks go down with the pool
+    while (m_slots != nullptr) {
+        MagazineSlot* slot = m_slots;
+        m_slots = slot->m_next_slot;
+
+        *slot = MagazineSlot{};
+    }
+
+    m_full_count = 0;
+}
+
+inline ThreadMagazines::~ThreadMagazines() {
+    std::lock_guard<std::mutex> magazine_lock(m_magazine_mutex);
+
+    for (size_t set_idx = 0; set_idx < THREAD_MAGAZINE_SETS; ++set_idx) {
+        for (MagazineSlot& slot : m_slots[set_idx]) {
+            if (slot.m_depot != nullptr) {
+                slot.m_depot->unbindSlot(slot);
+            }
+        }
+    }
+}
+
+};  // namespace X17
+
+#endif  // !X17_MAGAZINE_CACHE
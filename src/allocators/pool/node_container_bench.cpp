@@ -0,0 +1,158 @@
+////////////////////////////////////////////////////////////
+/// Headers
+////////////////////////////////////////////////////////////
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <list>
+#include <map>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "pool_alloc_stl.hpp"
+
+/* inserts and erases random keys in node containers backed by the STL
+ * PoolAllocator and by std::allocator. The containers rebind the allocator
+ * to their node types, whose nodes then come from the pool of the node size:
+ *
+ *     g++ -std=c++17 -O2 node_container_bench.cpp -o node_container_bench
+ *     ./node_container_bench [keys] [rounds]
+ */
+
+using namespace X17;
+
+static const size_t BENCH_KEYS = 1 << 16;
+static const size_t BENCH_ROUNDS = 32;
+
+template <typename T>
+using BenchPool = PoolAllocator<T>;
+
+template <typename Key, typename Value, template <typename> class Alloc>
+using BenchMap = std::map<Key, Value, std::less<Key>, Alloc<std::pair<const Key, Value>>>;
+
+template <typename Key, typename Value, template <typename> class Alloc>
+using BenchUnorderedMap = std::unordered_map<Key, Value, std::hash<Key>, std::equal_to<Key>,
+                                             Alloc<std::pair<const Key, Value>>>;
+
+/* millions of insert + erase pairs per second */
+template <typename Container, typename Insert, typename Erase>
+double runBench(const std::vector<uint64_t>& keys, const size_t n_rounds, Insert insert,
+                Erase erase) {
+    Container container;
+    uint64_t checksum = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t round = 0; round < n_rounds; ++round) {
+        for (uint64_t key : keys) {
+            insert(container, key);
+        }
+
+        checksum += container.size();
+
+        // erase in insertion order, so the nodes are freed out of address order
+        for (uint64_t key : keys) {
+            erase(container, key);
+        }
+    }
+
+    double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (checksum != keys.size() * n_rounds) {
+        printf("  lost keys\n");
+    }
+
+    return (double)(keys.size() * n_rounds) / seconds / 1e6;
+}
+
+template <template <typename> class Alloc>
+double benchMap(const std::vector<uint64_t>& keys, const size_t n_rounds) {
+    typedef BenchMap<uint64_t, uint64_t, Alloc> Map;
+    return runBench<Map>(
+        keys, n_rounds, [](Map& map, uint64_t key) { map.emplace(key, key); },
+        [](Map& map, uint64_t key) { map.erase(key); });
+}
+
+template <template <typename> class Alloc>
+double benchUnorderedMap(const std::vector<uint64_t>& keys, const size_t n_rounds) {
+    typedef BenchUnorderedMap<uint64_t, uint64_t, Alloc> Map;
+    return runBench<Map>(
+        keys, n_rounds, [](Map& map, uint64_t key) { map.emplace(key, key); },
+        [](Map& map, uint64_t key) { map.erase(key); });
+}
+
+template <template <typename> class Alloc>
+double benchList(const std::vector<uint64_t>& keys, const size_t n_rounds) {
+    typedef std::list<uint64_t, Alloc<uint64_t>> List;
+    // odd keys go to the back, even ones to the front, erased from both ends
+    return runBench<List>(
+        keys, n_rounds,
+        [](List& list, uint64_t key) {
+            if (key & 1) {
+                list.push_back(key);
+            } else {
+                list.push_front(key);
+            }
+        },
+        [](List& list, uint64_t key) {
+            if (key & 1) {
+                list.pop_back();
+            } else {
+                list.pop_front();
+            }
+        });
+}
+
+/* default-constructed pooled lists share their pools and so can splice and
+ * merge (std::list aborts on unequal allocators) */
+bool checkSpliceMerge(const std::vector<uint64_t>& keys) {
+    typedef std::list<uint64_t, BenchPool<uint64_t>> List;
+    List odd_keys;
+    List even_keys;
+
+    for (uint64_t key : keys) {
+        (key & 1 ? odd_keys : even_keys).push_back(key);
+    }
+
+    odd_keys.sort();
+    even_keys.sort();
+    odd_keys.merge(even_keys);
+
+    List spliced;
+    spliced.splice(spliced.end(), odd_keys);
+
+    return odd_keys.empty() && even_keys.empty() && spliced.size() == keys.size() &&
+           std::is_sorted(spliced.begin(), spliced.end());
+}
+
+int main(int argc, char* argv[]) {
+    size_t n_keys = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : BENCH_KEYS;
+    size_t n_rounds = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : BENCH_ROUNDS;
+
+    std::vector<uint64_t> keys(n_keys);
+    std::mt19937_64 random(42);
+    for (uint64_t& key : keys) {
+        key = random();
+    }
+
+    printf("%zu keys, %zu rounds, Mops/s\n", n_keys, n_rounds);
+    printf("%-16s %14s %14s\n", "container", "pool", "std");
+
+    printf("%-16s %14.1f %14.1f\n", "map", benchMap<BenchPool>(keys, n_rounds),
+           benchMap<std::allocator>(keys, n_rounds));
+    printf("%-16s %14.1f %14.1f\n", "unordered_map",
+           benchUnorderedMap<BenchPool>(keys, n_rounds),
+           benchUnorderedMap<std::allocator>(keys, n_rounds));
+    printf("%-16s %14.1f %14.1f\n", "list", benchList<BenchPool>(keys, n_rounds),
+           benchList<std::allocator>(keys, n_rounds));
+
+    if (!checkSpliceMerge(keys)) {
+        printf("  splice/merge lost keys\n");
+    }
+
+    return 0;
+}
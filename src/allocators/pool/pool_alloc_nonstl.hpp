@@ -5,83 +5,462 @@
 /// Headers
 ////////////////////////////////////////////////////////////
 #include <cstdint>
+#include <cstdlib>
 #include <iostream>
 #include <new>
 #include <exception>
+#include <algorithm>
+#include <atomic>
+#include <utility>
+
+// PoolAllocator config file (modified by user)
+#include "config_pool.hpp"
+#include "lock_free_stack.hpp"
+#include "sort_list.hpp"
+#include "magazine_cache.hpp"
+#include "pool_blocks.hpp"
 
 #define POOL_NOEXCEPT 1
 
 namespace X17 {
 
-struct Chunk {
-    Chunk* m_next;
+// SlabAllocator size classes: SLAB_STEP apart up to SLAB_SMALL_BYTES, then
+// SLAB_SPLITS classes per power of two up to SLAB_MAX_BYTES
+static const size_t SLAB_STEP = 8;
+static const size_t SLAB_SMALL_BYTES = 128;
+static const size_t SLAB_SMALL_LOG = 7;
+static const size_t SLAB_SPLITS_LOG = 2;
+static const size_t SLAB_MAX_BYTES = 1024;
+static const size_t SLAB_MAX_LOG = 10;
+static const size_t SLAB_SMALL_CLASSES = SLAB_SMALL_BYTES / SLAB_STEP;
+static const size_t SLAB_CLASSES =
+    SLAB_SMALL_CLASSES + ((SLAB_MAX_LOG - SLAB_SMALL_LOG) << SLAB_SPLITS_LOG);
+
+static const size_t DEFAULT_SLAB_CHUNKS_PER_BLOCK = 256;
+static const size_t DEFAULT_OBJECT_CHUNKS_PER_BLOCK = 256;
+
+// chunks deallocateBulk() prefetches ahead of the one it links
+static const size_t BULK_PREFETCH_DISTANCE = 8;
+
+struct PoolChunk {
+    PoolChunk* m_next;
+};
+
+// every block starts with its header, the chunks follow
+struct PoolBlock {
+    PoolBlock* m_next;
+    // counted by trim()
+    size_t m_free_chunks;
 };
 
+/* free list of equal chunks carved from blocks, lock-free and thread-safe
+ * with POOL_LOCK_FREE. Blocks are released by trim() once all their chunks
+ * are free, and by the destructor. By default they come from
+ * allocateBlock() (pool_blocks.hpp) */
 class PoolAllocator {
    public:
-    PoolAllocator(const size_t chunks_per_block)
-        : m_chunks_per_block(chunks_per_block) {}
+    // where blocks of chunks come from and go back to, blocks of a source
+    // without release are kept
+    typedef void* (*BlockSource)(const size_t n_bytes);
+    typedef void (*BlockRelease)(void* block, const size_t n_bytes);
+
+    PoolAllocator(const size_t chunks_per_block,
+                  BlockSource block_source = allocateBlock,
+                  BlockRelease block_release = freeBlock)
+        : m_chunks_per_block(chunks_per_block),
+          m_block_source(block_source),
+          m_block_release(block_release) {}
+
+    ~PoolAllocator();
 
     void*  allocate(const size_t n_bytes);
     void deallocate(void* mem_ptr, const size_t n_bytes);
 
+    /* fills chunks with up to n_chunks chunks, returns how many: a segment
+     * of the free list is cut off at once, then fresh blocks are carved */
+    size_t allocateBulk(const size_t n_bytes, const size_t n_chunks, void** chunks);
+    /* links the chunks (nullptr is skipped) and splices them in at once */
+    void deallocateBulk(void** chunks, const size_t n_chunks, const size_t n_bytes);
+
+    /* releases the blocks with no chunk in use but spare_blocks of them,
+     * returns the bytes released. Nothing else may use the pool meanwhile,
+     * not even with POOL_LOCK_FREE */
+    size_t trim(const size_t spare_blocks = 0);
+
+   private:
+    size_t blockBytes(const size_t chunk_size) const {
+        return sizeof(PoolBlock) + m_chunks_per_block * chunk_size;
+    }
+
    private:
     size_t m_chunks_per_block;
+    BlockSource m_block_source;
+    BlockRelease m_block_release;
+
+    // pushed by concurrent refills with POOL_LOCK_FREE
+    TaggedStack<PoolBlock> m_blocks;
+
+    // fixed by the first block, bigger requests fail
+    std::atomic<size_t> m_chunk_size{0};
 
-    Chunk* m_alloc = nullptr;
-    Chunk* m_alloc_block(const size_t n_bytes);
+#ifndef POOL_LOCK_FREE
+    PoolChunk* m_alloc = nullptr;
+#else
+    TaggedStack<PoolChunk> m_alloc;
+#endif  // !POOL_LOCK_FREE
+    PoolChunk* m_alloc_block(const size_t n_bytes);
 };
 
-struct Object {
-    // exactly 16 bytes for object data
-    uint64_t m_data[2];
+/* one PoolAllocator per size class, any request up to SLAB_MAX_BYTES goes
+ * to the pool of its class, bigger ones to malloc. Like PoolAllocator it is
+ * thread-safe only with POOL_LOCK_FREE */
+class SlabAllocator {
+   public:
+    typedef PoolAllocator::BlockSource BlockSource;
+    typedef PoolAllocator::BlockRelease BlockRelease;
+
+    SlabAllocator(
+        const size_t chunks_per_block = DEFAULT_SLAB_CHUNKS_PER_BLOCK,
+        BlockSource block_source = allocateBlock,
+        BlockRelease block_release = freeBlock)
+        : SlabAllocator(chunks_per_block, block_source, block_release,
+                        std::make_index_sequence<SLAB_CLASSES>()) {}
+
+    void* allocate(const size_t n_bytes);
+    void deallocate(void* mem_ptr, const size_t n_bytes);
+
+    /* PoolAllocator::trim() of every class */
+    size_t trim(const size_t spare_blocks = 0);
+
+    static constexpr size_t sizeClass(const size_t n_bytes);
+    static constexpr size_t classBytes(const size_t class_idx);
+
+    /* the slab behind SlabObject */
+    static SlabAllocator& instance();
 
-    static PoolAllocator m_allocator;
+   private:
+    template <size_t... ClassIndices>
+    SlabAllocator(const size_t chunks_per_block, BlockSource block_source,
+                  BlockRelease block_release, std::index_sequence<ClassIndices...>)
+        : m_pools{((void)ClassIndices,
+                   PoolAllocator(chunks_per_block, block_source, block_release))...} {}
+
+    PoolAllocator m_pools[SLAB_CLASSES];
+};
+
+/* inherit from SlabObject to have new and delete of a class served by the
+ * slab */
+struct SlabObject {
+    static void* operator new(const size_t n_bytes) {
+        return slabNew(n_bytes);
+    }
+
+    static void* operator new[](const size_t n_bytes) {
+        return slabNew(n_bytes);
+    }
+
+    static void operator delete(void* mem_ptr, const size_t n_bytes) {
+        SlabAllocator::instance().deallocate(mem_ptr, n_bytes);
+    }
+
+    static void operator delete[](void* mem_ptr, const size_t n_bytes) {
+        SlabAllocator::instance().deallocate(mem_ptr, n_bytes);
+    }
+
+   private:
+    static void* slabNew(const size_t n_bytes) {
+        void* mem_ptr = SlabAllocator::instance().allocate(n_bytes);
+
+        // operator new never returns nullptr
+        if (mem_ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+
+        return mem_ptr;
+    }
+};
+
+/* chunk interface of MagazineCache (magazine_cache.hpp) */
+inline void* chunkAllocate(PoolAllocator& pool, const size_t n_bytes) {
+    return pool.allocate(n_bytes);
+}
 
+inline void chunkDeallocate(PoolAllocator& pool, void* chunk, const size_t n_bytes) {
+    pool.deallocate(chunk, n_bytes);
+}
+
+/* inherit from PoolAllocated<Derived> to have new and delete of Derived
+ * served by a pool of its own, with chunks of sizeof(Derived) behind
+ * per-thread magazines. Arrays, over-aligned types and classes derived from
+ * Derived with another size go to the global operator new */
+template <typename Derived, size_t ChunksPerBlock = DEFAULT_OBJECT_CHUNKS_PER_BLOCK>
+struct PoolAllocated {
     static void* operator new(const size_t n_bytes) {
-        return m_allocator.allocate(n_bytes);
+        if (!fitsPool(n_bytes)) {
+            return ::operator new(n_bytes);
+        }
+
+        void* mem_ptr = cache().allocate();
+
+        // operator new never returns nullptr
+        if (mem_ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+
+        return mem_ptr;
+    }
+
+    static void* operator new[](const size_t n_bytes) {
+        return ::operator new[](n_bytes);
     }
 
     static void operator delete(void* mem_ptr, const size_t n_bytes) {
-        return m_allocator.deallocate(mem_ptr, n_bytes);
+        if (!fitsPool(n_bytes)) {
+            ::operator delete(mem_ptr);
+            return;
+        }
+
+        cache().deallocate(mem_ptr);
+    }
+
+    static void operator delete[](void* mem_ptr) {
+        ::operator delete[](mem_ptr);
+    }
+
+    // new and delete of over-aligned classes look for these first
+    static void* operator new(const size_t n_bytes, const std::align_val_t alignment) {
+        return ::operator new(n_bytes, alignment);
+    }
+
+    static void* operator new[](const size_t n_bytes, const std::align_val_t alignment) {
+        return ::operator new[](n_bytes, alignment);
+    }
+
+    static void operator delete(void* mem_ptr, const std::align_val_t alignment) {
+        ::operator delete(mem_ptr, alignment);
+    }
+
+    static void operator delete[](void* mem_ptr, const std::align_val_t alignment) {
+        ::operator delete[](mem_ptr, alignment);
+    }
+
+   private:
+    // Derived is complete only once these are called
+    static constexpr size_t chunkBytes() {
+        // a multiple of alignof(Derived) either way, blocks and their
+        // headers keep max_align_t alignment
+        return std::max(sizeof(Derived), sizeof(PoolChunk));
+    }
+
+    static constexpr bool fitsPool(const size_t n_bytes) {
+        return n_bytes == sizeof(Derived) &&
+               alignof(Derived) <= alignof(std::max_align_t);
+    }
+
+    static MagazineCache<PoolAllocator>& cache() {
+        // never destroyed: objects may still be deleted by static destructors
+        static PoolAllocator* pool = new PoolAllocator(ChunksPerBlock);
+        static MagazineCache<PoolAllocator>* cache =
+            new MagazineCache<PoolAllocator>(*pool, chunkBytes());
+
+        return *cache;
     }
 };
 
-// allocator instance
-PoolAllocator Object::m_allocator{8};
+struct Object : PoolAllocated<Object> {
+    // exactly 16 bytes for object data
+    uint64_t m_data[2];
+};
 
-void* PoolAllocator::allocate(const size_t n_bytes) {
+inline void* PoolAllocator::allocate(const size_t n_bytes) {
     if (n_bytes == 0) {
         return nullptr;
     }
 
+    size_t chunk_size = m_chunk_size.load(std::memory_order_relaxed);
+    if (chunk_size != 0 && n_bytes > chunk_size) {
+        #ifndef POOL_NOEXCEPT
+        throw std::bad_alloc();
+        #endif // POOL_NOEXCEPT
+
+        return nullptr;
+    }
+
+#ifndef POOL_LOCK_FREE
     if (m_alloc == nullptr) {
-        m_alloc = m_alloc_block(n_bytes);
+        m_alloc = m_alloc_block(chunk_size != 0 ? chunk_size : n_bytes);
+
+        if (m_alloc == nullptr) {
+            return nullptr;
+        }
     }
 
-    Chunk* allocated_chunk = m_alloc;
+    PoolChunk* allocated_chunk = m_alloc;
     m_alloc = m_alloc->m_next;
 
     return allocated_chunk;
+#else
+    if (PoolChunk* allocated_chunk = m_alloc.pop()) {
+        return allocated_chunk;
+    }
+
+    // every thread that finds the list empty carves a block of its own and
+    // shares all but the first chunk with a single push
+    PoolChunk* first_chunk = m_alloc_block(chunk_size != 0 ? chunk_size : n_bytes);
+    if (first_chunk == nullptr) {
+        return nullptr;
+    }
+
+    if (first_chunk->m_next != nullptr) {
+        PoolChunk* last_chunk = reinterpret_cast<PoolChunk*>(
+            reinterpret_cast<uint8_t*>(first_chunk) +
+            (m_chunks_per_block - 1) * m_chunk_size.load(std::memory_order_relaxed));
+
+        m_alloc.pushChain(first_chunk->m_next, last_chunk);
+    }
+
+    return first_chunk;
+#endif  // !POOL_LOCK_FREE
 }
 
-void PoolAllocator::deallocate(void* mem_ptr, const size_t n_bytes) {
+inline void PoolAllocator::deallocate(void* mem_ptr, const size_t n_bytes) {
     if (mem_ptr == nullptr || n_bytes == 0) {
         return;
     }
 
-    reinterpret_cast<Chunk*>(mem_ptr)->m_next = m_alloc;
-    m_alloc = reinterpret_cast<Chunk*>(mem_ptr);
+#ifndef POOL_LOCK_FREE
+    reinterpret_cast<PoolChunk*>(mem_ptr)->m_next = m_alloc;
+    m_alloc = reinterpret_cast<PoolChunk*>(mem_ptr);
+#else
+    m_alloc.push(reinterpret_cast<PoolChunk*>(mem_ptr));
+#endif  // !POOL_LOCK_FREE
 
     return;
 }
 
-Chunk* PoolAllocator::m_alloc_block(const size_t chunk_size) {
-    size_t block_size = m_chunks_per_block * chunk_size;
+inline size_t PoolAllocator::allocateBulk(const size_t n_bytes, const size_t n_chunks,
+                                          void** chunks) {
+    if (n_bytes == 0 || n_chunks == 0) {
+        return 0;
+    }
+
+    size_t chunk_size = m_chunk_size.load(std::memory_order_relaxed);
+    if (chunk_size != 0 && n_bytes > chunk_size) {
+        #ifndef POOL_NOEXCEPT
+        throw std::bad_alloc();
+        #endif // POOL_NOEXCEPT
+
+        return 0;
+    }
+
+    size_t n_taken = 0;
+
+#ifndef POOL_LOCK_FREE
+    while (n_taken < n_chunks) {
+        if (m_alloc == nullptr) {
+            m_alloc = m_alloc_block(chunk_size != 0 ? chunk_size : n_bytes);
+
+            if (m_alloc == nullptr) {
+                break;
+            }
+        }
+
+        // the next chunk is fetched while the current one is handed out
+        PoolChunk* current_chunk = m_alloc;
+        while (current_chunk != nullptr && n_taken < n_chunks) {
+            PoolChunk* next_chunk = current_chunk->m_next;
+            __builtin_prefetch(next_chunk);
+
+            chunks[n_taken++] = current_chunk;
+            current_chunk = next_chunk;
+        }
+
+        m_alloc = current_chunk;
+    }
+#else
+    // no CAS cuts a segment off a shared stack, so chunks are popped one by
+    // one until the stack is empty
+    while (n_taken < n_chunks) {
+        PoolChunk* current_chunk = m_alloc.pop();
+        if (current_chunk == nullptr) {
+            break;
+        }
+
+        chunks[n_taken++] = current_chunk;
+    }
+
+    while (n_taken < n_chunks) {
+        PoolChunk* current_chunk = m_alloc_block(chunk_size != 0 ? chunk_size : n_bytes);
+        if (current_chunk == nullptr) {
+            break;
+        }
+
+        PoolChunk* last_chunk = reinterpret_cast<PoolChunk*>(
+            reinterpret_cast<uint8_t*>(current_chunk) +
+            (m_chunks_per_block - 1) * m_chunk_size.load(std::memory_order_relaxed));
+
+        while (current_chunk != nullptr && n_taken < n_chunks) {
+            chunks[n_taken++] = current_chunk;
+            current_chunk = current_chunk->m_next;
+        }
+
+        // the rest of the block is shared with a single push
+        if (current_chunk != nullptr) {
+            m_alloc.pushChain(current_chunk, last_chunk);
+        }
+    }
+#endif  // !POOL_LOCK_FREE
+
+    return n_taken;
+}
+
+inline void PoolAllocator::deallocateBulk(void** chunks, const size_t n_chunks,
+                                          const size_t n_bytes) {
+    if (n_bytes == 0) {
+        return;
+    }
+
+    PoolChunk* first_chunk = nullptr;
+    PoolChunk* last_chunk = nullptr;
+
+    for (size_t chunk_idx = 0; chunk_idx < n_chunks; ++chunk_idx) {
+        if (chunk_idx + BULK_PREFETCH_DISTANCE < n_chunks) {
+            __builtin_prefetch(chunks[chunk_idx + BULK_PREFETCH_DISTANCE], 1);
+        }
+
+        PoolChunk* current_chunk = reinterpret_cast<PoolChunk*>(chunks[chunk_idx]);
+        if (current_chunk == nullptr) {
+            continue;
+        }
+
+        if (last_chunk != nullptr) {
+            last_chunk->m_next = current_chunk;
+        } else {
+            first_chunk = current_chunk;
+        }
+        last_chunk = current_chunk;
+    }
+
+    if (first_chunk == nullptr) {
+        return;
+    }
+
+#ifndef POOL_LOCK_FREE
+    last_chunk->m_next = m_alloc;
+    m_alloc = first_chunk;
+#else
+    m_alloc.pushChain(first_chunk, last_chunk);
+#endif  // !POOL_LOCK_FREE
+}
+
+inline PoolChunk* PoolAllocator::m_alloc_block(const size_t n_bytes) {
+    // every chunk has to hold the free-list link
+    size_t chunk_size = std::max(n_bytes, sizeof(PoolChunk));
 
-    // in case malloc(block_size) returns NULL, reinterpreter_cast will cast it to nullptr anyway, so we don't need to do external check here
-    Chunk* first_chunk_of_new_block = reinterpret_cast<Chunk*>(malloc(block_size));
-    if (first_chunk_of_new_block == nullptr) {
+    // in case m_block_source(block_size) returns NULL, reinterpreter_cast will cast it to nullptr anyway, so we don't need to do external check here
+    PoolBlock* new_block =
+        reinterpret_cast<PoolBlock*>(m_block_source(blockBytes(chunk_size)));
+    if (new_block == nullptr) {
         #ifndef POOL_NOEXCEPT
         throw std::bad_alloc();
         #endif // POOL_NOEXCEPT
@@ -89,18 +468,193 @@ Chunk* PoolAllocator::m_alloc_block(const size_t chunk_size) {
         return nullptr;
     }
 
-    Chunk* current_chunk = first_chunk_of_new_block;
+    m_blocks.push(new_block);
+
+    PoolChunk* first_chunk_of_new_block = reinterpret_cast<PoolChunk*>(new_block + 1);
+
+    PoolChunk* current_chunk = first_chunk_of_new_block;
 
     for (size_t chunk_index = 0; chunk_index < m_chunks_per_block - 1; ++chunk_index) {
         // shift m_chunk by chunk_size bytes
-        current_chunk->m_next = reinterpret_cast<Chunk*>(reinterpret_cast<uint8_t>(current_chunk) + chunk_size);
+        current_chunk->m_next = reinterpret_cast<PoolChunk*>(
+            reinterpret_cast<uint8_t*>(current_chunk) + chunk_size);
         current_chunk = current_chunk->m_next;
     }
 
     // last chunk in chain always should point to nullptr
     current_chunk->m_next = nullptr;
 
-    return current_chunk;
+    m_chunk_size.store(chunk_size, std::memory_order_relaxed);
+    return first_chunk_of_new_block;
+}
+
+inline PoolAllocator::~PoolAllocator() {
+    if (m_block_release == nullptr) {
+        return;
+    }
+
+    size_t block_bytes = blockBytes(m_chunk_size.load(std::memory_order_relaxed));
+
+    PoolBlock* block = m_blocks.popAll();
+    while (block != nullptr) {
+        PoolBlock* next_block = block->m_next;
+        m_block_release(block, block_bytes);
+        block = next_block;
+    }
+}
+
+inline size_t PoolAllocator::trim(const size_t spare_blocks) {
+    size_t chunk_size = m_chunk_size.load(std::memory_order_relaxed);
+    if (m_block_release == nullptr || chunk_size == 0) {
+        return 0;
+    }
+
+#ifndef POOL_LOCK_FREE
+    PoolChunk* free_chunk = m_alloc;
+    m_alloc = nullptr;
+#else
+    PoolChunk* free_chunk = m_alloc.popAll();
+#endif  // !POOL_LOCK_FREE
+
+    // with both lists in address order, the free chunks of a block are the
+    // ones below its end not taken by an earlier block
+    free_chunk = sortByAddress(free_chunk);
+    PoolBlock* block = sortByAddress(m_blocks.popAll());
+    size_t block_bytes = blockBytes(chunk_size);
+
+    PoolChunk* kept_chunks = nullptr;
+    PoolChunk** kept_chunks_tail = &kept_chunks;
+    PoolChunk* last_kept_chunk = nullptr;
+
+    PoolBlock* kept_blocks = nullptr;
+    PoolBlock* last_kept_block = nullptr;
+
+    size_t spare_left = spare_blocks;
+    size_t released_bytes = 0;
+
+    while (block != nullptr) {
+        PoolBlock* next_block = block->m_next;
+        uint8_t* block_end = reinterpret_cast<uint8_t*>(block) + block_bytes;
+
+        PoolChunk* block_chunks = free_chunk;
+        block->m_free_chunks = 0;
+        while (free_chunk != nullptr && reinterpret_cast<uint8_t*>(free_chunk) < block_end) {
+            ++block->m_free_chunks;
+            free_chunk = free_chunk->m_next;
+        }
+
+        bool unused = block->m_free_chunks == m_chunks_per_block;
+        if (unused && spare_left == 0) {
+            m_block_release(block, block_bytes);
+            released_bytes += block_bytes;
+        } else {
+            spare_left -= unused ? 1 : 0;
+
+            if (block->m_free_chunks != 0) {
+                *kept_chunks_tail = block_chunks;
+                for (size_t chunk_idx = 1; chunk_idx < block->m_free_chunks; ++chunk_idx) {
+                    block_chunks = block_chunks->m_next;
+                }
+                last_kept_chunk = block_chunks;
+                kept_chunks_tail = &block_chunks->m_next;
+            }
+
+            block->m_next = kept_blocks;
+            kept_blocks = block;
+            if (last_kept_block == nullptr) {
+                last_kept_block = block;
+            }
+        }
+
+        block = next_block;
+    }
+
+    *kept_chunks_tail = nullptr;
+
+    if (kept_blocks != nullptr) {
+        m_blocks.pushChain(kept_blocks, last_kept_block);
+    }
+
+    // the free list is left in address order
+#ifndef POOL_LOCK_FREE
+    m_alloc = kept_chunks;
+    (void)last_kept_chunk;
+#else
+    if (kept_chunks != nullptr) {
+        m_alloc.pushChain(kept_chunks, last_kept_chunk);
+    }
+#endif  // !POOL_LOCK_FREE
+
+    return released_bytes;
+}
+
+inline void* SlabAllocator::allocate(const size_t n_bytes) {
+    if (n_bytes > SLAB_MAX_BYTES) {
+        return std::malloc(n_bytes);
+    }
+
+    if (n_bytes == 0) {
+        return nullptr;
+    }
+
+    size_t class_idx = sizeClass(n_bytes);
+    return m_pools[class_idx].allocate(classBytes(class_idx));
+}
+
+inline void SlabAllocator::deallocate(void* mem_ptr, const size_t n_bytes) {
+    if (n_bytes > SLAB_MAX_BYTES) {
+        std::free(mem_ptr);
+        return;
+    }
+
+    if (mem_ptr == nullptr || n_bytes == 0) {
+        return;
+    }
+
+    size_t class_idx = sizeClass(n_bytes);
+    m_pools[class_idx].deallocate(mem_ptr, classBytes(class_idx));
+}
+
+/* smallest class holding n_bytes (1 <= n_bytes <= SLAB_MAX_BYTES) */
+constexpr size_t SlabAllocator::sizeClass(const size_t n_bytes) {
+    if (n_bytes <= SLAB_SMALL_BYTES) {
+        return (n_bytes - 1) / SLAB_STEP;
+    }
+
+    // power of two below n_bytes, then its quarter n_bytes falls into
+    size_t log = 63 - __builtin_clzll(n_bytes - 1);
+    size_t split = ((n_bytes - 1) >> (log - SLAB_SPLITS_LOG)) &
+                   ((1 << SLAB_SPLITS_LOG) - 1);
+
+    return SLAB_SMALL_CLASSES + ((log - SLAB_SMALL_LOG) << SLAB_SPLITS_LOG) + split;
+}
+
+constexpr size_t SlabAllocator::classBytes(const size_t class_idx) {
+    if (class_idx < SLAB_SMALL_CLASSES) {
+        return (class_idx + 1) * SLAB_STEP;
+    }
+
+    size_t group_bytes = SLAB_SMALL_BYTES
+                         << ((class_idx - SLAB_SMALL_CLASSES) >> SLAB_SPLITS_LOG);
+    size_t split = (class_idx - SLAB_SMALL_CLASSES) & ((1 << SLAB_SPLITS_LOG) - 1);
+
+    return group_bytes + (split + 1) * (group_bytes >> SLAB_SPLITS_LOG);
+}
+
+inline size_t SlabAllocator::trim(const size_t spare_blocks) {
+    size_t released_bytes = 0;
+
+    for (PoolAllocator& pool : m_pools) {
+        released_bytes += pool.trim(spare_blocks);
+    }
+
+    return released_bytes;
+}
+
+inline SlabAllocator& SlabAllocator::instance() {
+    // never destroyed: SlabObjects may still be deleted by static destructors
+    static SlabAllocator* slab = new SlabAllocator();
+    return *slab;
 }
 
 };  // namespace X17
@@ -14,25 +14,35 @@
 #include <cstdio>
 #include <filesystem>
 #include <memory>
+#include <atomic>
+#include <algorithm>
+#include <limits>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
 
 // PoolAllocator config file (modified by user)
 #include "config_pool.hpp"
-
-
-#ifdef POOL_ALLOC_DEBUG
-#define DEBUG
-#endif
+#include "lock_free_stack.hpp"
+#include "sort_list.hpp"
+#include "pool_blocks.hpp"
+#include "pool_telemetry.hpp"
 
 #ifndef DEFAULT_CHUNKS_PER_BLOCK
 #define DEFAULT_CHUNKS_PER_BLOCK 4 * 1024
 #endif
 
+#ifndef POOL_INITIAL_CHUNKS
+#define POOL_INITIAL_CHUNKS 32
+#endif
+
 namespace X17 {
 
-#ifdef DEBUG
-static const std::string m_log_filename = "alloc_logs/mempool.log";
-static FILE* m_log_stream = nullptr;
-#endif  // DEBUG
+// every ObjectPool of a MemPool holds this many times the chunks of the
+// previous one, up to the largest block of the pool
+static const std::size_t POOL_BLOCK_GROWTH = 2;
 
 template <typename T, std::size_t chunksPerBlock = DEFAULT_CHUNKS_PER_BLOCK>
 class MemPool {
@@ -46,118 +56,403 @@ class MemPool {
         Chunk* m_next;
     };
 
+    /* header of a block of m_chunks chunks, the chunks follow it. Blocks
+     * grow geometrically, so each one knows its own size */
     class ObjectPool {
        public:
-        ObjectPool(ObjectPool* const next_pool) : m_next(next_pool) {
-#ifdef DEBUG
-            fprintf(m_log_stream,
-                    "\nObjectPool created with argument next_pool='%p'.");
-#endif  // DEBUG
+        static ObjectPool* create(ObjectPool* const next_pool, const std::size_t n_chunks) {
+            ObjectPool* object_pool =
+                reinterpret_cast<ObjectPool*>(newBlock(blockBytes(n_chunks)));
+            object_pool->m_next = next_pool;
+            object_pool->m_chunks = n_chunks;
+
+            return object_pool;
+        }
+
+        static void destroy(ObjectPool* const object_pool) {
+            deleteBlock(object_pool, blockBytes(object_pool->m_chunks));
+        }
+
+        static std::size_t blockBytes(const std::size_t n_chunks) {
+            return bufferOffset() + n_chunks * m_bytes_per_block;
+        }
+
+        /* chunks of a block of at least n_chunks chunks. A mapped block takes
+         * whole (huge) pages, so its chunks run up to the end of them */
+        static std::size_t fittedChunks(const std::size_t n_chunks) {
+#if defined(POOL_HUGE_PAGES) || defined(POOL_PREFAULT)
+            return (mappedBlockBytes(blockBytes(n_chunks), POOL_BLOCK_HUGE_PAGES) -
+                    bufferOffset()) /
+                   m_bytes_per_block;
+#else
+            return n_chunks;
+#endif  // POOL_HUGE_PAGES || POOL_PREFAULT
         }
 
        public:
-        // cannot modify m_next!! (to avoid collisions)
-        ObjectPool* const m_next;
+        // set while the pool is linked in and relinked by trim() only
+        ObjectPool* m_next;
+        std::size_t m_chunks;
 
         // m_bytes_per_block is min(sizeof(T), sizeof(Chunk))
         static const std::size_t m_bytes_per_block = sizeof(Chunk) > sizeof(T)
                                                          ? sizeof(Chunk)
                                                          : sizeof(T);
-        uint8_t m_buffer[chunksPerBlock * m_bytes_per_block];
+        static const std::size_t m_chunk_alignment =
+            alignof(T) > alignof(Chunk) ? alignof(T) : alignof(Chunk);
+
+        // the chunks start after the header on their own alignment
+        static std::size_t bufferOffset() {
+            return (sizeof(ObjectPool) + m_chunk_alignment - 1) & ~(m_chunk_alignment - 1);
+        }
+
+        uint8_t* buffer() { return reinterpret_cast<uint8_t*>(this) + bufferOffset(); }
+        uint8_t* bufferEnd() { return buffer() + m_chunks * m_bytes_per_block; }
 
         // TODO: ask how to mark this func as const and not get 'cast away
         // qualifiers' error
         pointer recieve_chunk(const std::size_t chunk_index) {
-#ifdef DEBUG
-            fprintf(m_log_stream,
-                    "\nAccess in ObjectPool chunk with index '%zu'. Chunk "
-                    "addr:'%p'.",
-                    chunk_index, m_buffer + chunk_index * m_bytes_per_block);
-#endif  // DEBUG
+            return reinterpret_cast<pointer>(buffer() + chunk_index * m_bytes_per_block);
+        }
 
-            return reinterpret_cast<pointer>(m_buffer +
-                                             chunk_index * m_bytes_per_block);
+       private:
+        static std::size_t blockAlignment() {
+            return alignof(ObjectPool) > m_chunk_alignment ? alignof(ObjectPool)
+                                                           : m_chunk_alignment;
+        }
+
+        static void* newBlock(const std::size_t n_bytes) {
+#if defined(POOL_HUGE_PAGES) || defined(POOL_PREFAULT)
+            // every ObjectPool is a block of its own (whole huge pages)
+            void* block = allocateBlock(n_bytes);
+            if (block == nullptr) {
+                throw std::bad_alloc();
+            }
+
+            return block;
+#else
+            return ::operator new(n_bytes, std::align_val_t(blockAlignment()));
+#endif  // POOL_HUGE_PAGES || POOL_PREFAULT
+        }
+
+        static void deleteBlock(void* block, const std::size_t n_bytes) {
+#if defined(POOL_HUGE_PAGES) || defined(POOL_PREFAULT)
+            freeBlock(block, n_bytes);
+#else
+            ::operator delete(block, n_bytes, std::align_val_t(blockAlignment()));
+#endif  // POOL_HUGE_PAGES || POOL_PREFAULT
         }
     };
 
    public:
     pointer allocate() {
-#ifdef DEBUG
-        fprintf(m_log_stream,
-                "\nallocate() called in MemPool with addr:'%p'.", this);
-#endif  // DEBUG
+        pointer new_chunk = nullptr;
 
+#ifdef POOL_LOCK_FREE
+        if (Chunk* current_chunk = m_free_blocks.pop()) {
+            new_chunk = reinterpret_cast<pointer>(current_chunk);
+        } else {
+            carvePool(1, &new_chunk);
+        }
+#else
         if (m_free_blocks_head != nullptr) {
             Chunk* current_chunk = m_free_blocks_head;
             m_free_blocks_head = current_chunk->m_next;
 
             // just return pointer to first free block
-            return reinterpret_cast<pointer>(current_chunk);
-        }
-
-        if (m_blocks_in_pool >= chunksPerBlock) {
-            m_head_pool = new ObjectPool(m_head_pool);
+            new_chunk = reinterpret_cast<pointer>(current_chunk);
+        } else {
+            if (m_blocks_in_pool >= m_head_pool_chunks) {
+                linkPool();
+            }
 
-            // no blocks in new pool yet
-            m_blocks_in_pool = 0;
+            // get one block and increase pointer
+            new_chunk = m_head_pool->recieve_chunk(m_blocks_in_pool++);
+            m_telemetry.carve(1);
         }
+#endif  // POOL_LOCK_FREE
 
-        // get one block and increase pointer
-        return m_head_pool->recieve_chunk(m_blocks_in_pool++);
+        m_telemetry.allocate(new_chunk);
+        return new_chunk;
     }
 
     void deallocate(pointer mem_to_dealloc) {
-#ifdef DEBUG
-        fprintf(m_log_stream,
-                "\ndeallocate() with mem_to_dealloc='%p' called in MemPool "
-                "with addr:'%p'.",
-                mem_to_dealloc, this);
-#endif  // DEBUG
+        m_telemetry.deallocate(mem_to_dealloc);
 
         Chunk* current_chunk = reinterpret_cast<Chunk*>(mem_to_dealloc);
+
+#ifdef POOL_LOCK_FREE
+        m_free_blocks.push(current_chunk);
+#else
         current_chunk->m_next = m_free_blocks_head;
 
         // add freed chunk to list's head
         m_free_blocks_head = current_chunk;
+#endif  // POOL_LOCK_FREE
+    }
+
+    /* the first ObjectPool holds initial_chunks chunks, every further one
+     * POOL_BLOCK_GROWTH times more, up to max_chunks */
+    explicit MemPool(const std::size_t initial_chunks = POOL_INITIAL_CHUNKS,
+                     const std::size_t max_chunks = chunksPerBlock)
+        : m_max_chunks(std::max(max_chunks, (std::size_t)1)),
+          m_next_pool_chunks(std::min(std::max(initial_chunks, (std::size_t)1), m_max_chunks)) {}
+
+    ~MemPool() {
+        while (m_head_pool != nullptr) {
+            ObjectPool* current_object_pool = m_head_pool;
+            m_head_pool = current_object_pool->m_next;
+
+            // freeing current object pool
+            ObjectPool::destroy(current_object_pool);
+        }
     }
 
-    MemPool()
-        : m_blocks_in_pool(chunksPerBlock),
-          m_free_blocks_head(nullptr),
-          m_head_pool(nullptr) {
-#ifdef DEBUG
-        namespace fs = std::filesystem;
-        // TODO: ask ded if check is needed
-        if (!fs::is_directory("alloc_logs") || !fs::exists("alloc_logs")) {
-            if (!fs::create_directory("alloc_logs")) {
-                throw std::runtime_error(
-                    "log directory doesn't exist, creation failed");
+    /* counters of the pool, all zero without POOL_TELEMETRY (see
+     * pool_telemetry.hpp) */
+    PoolStats stats() const { return m_telemetry.stats(); }
+
+    /* fills chunks with n_chunks chunks and returns n_chunks: a segment of
+     * the free list is cut off at once, then a contiguous run is carved out
+     * of the current ObjectPool */
+    std::size_t allocateBulk(const std::size_t n_chunks, pointer* chunks) {
+        std::size_t n_taken = 0;
+
+#ifdef POOL_LOCK_FREE
+        // no CAS cuts a segment off a shared stack, so chunks are popped one
+        // by one until the stack is empty
+        while (n_taken < n_chunks) {
+            Chunk* current_chunk = m_free_blocks.pop();
+            if (current_chunk == nullptr) {
+                break;
             }
+
+            chunks[n_taken++] = reinterpret_cast<pointer>(current_chunk);
         }
 
-        m_log_stream = fopen(m_log_filename.c_str(), "a+");
-        if (m_log_stream == nullptr) {
-            throw std::runtime_error("can't open/create log file");
+        while (n_taken < n_chunks) {
+            n_taken += carvePool(n_chunks - n_taken, chunks + n_taken);
+        }
+#else
+        // the next chunk is fetched while the current one is handed out
+        Chunk* current_chunk = m_free_blocks_head;
+        while (current_chunk != nullptr && n_taken < n_chunks) {
+            Chunk* next_chunk = current_chunk->m_next;
+            __builtin_prefetch(next_chunk);
+
+            chunks[n_taken++] = reinterpret_cast<pointer>(current_chunk);
+            current_chunk = next_chunk;
         }
 
-        fprintf(m_log_stream,
-                "\nMemoryPool created. Addr:'%p'. Chunks per block:'%zu'.",
-                this, m_blocks_in_pool);
-#endif  // DEBUG
+        m_free_blocks_head = current_chunk;
+
+        while (n_taken < n_chunks) {
+            if (m_blocks_in_pool >= m_head_pool_chunks) {
+                linkPool();
+            }
+
+            std::size_t carved_from = n_taken;
+            while (m_blocks_in_pool < m_head_pool_chunks && n_taken < n_chunks) {
+                chunks[n_taken++] = m_head_pool->recieve_chunk(m_blocks_in_pool++);
+            }
+            m_telemetry.carve(n_taken - carved_from);
+        }
+#endif  // POOL_LOCK_FREE
+
+        if (n_taken != 0) {
+            m_telemetry.allocate(chunks[0], n_taken, PoolEventType::allocate_bulk);
+        }
+
+        return n_taken;
     }
 
-    ~MemPool() {
-        while (m_head_pool != nullptr) {
-            ObjectPool* current_object_pool = m_head_pool;
-            m_head_pool = current_object_pool->m_next;
+    /* links the chunks (nullptr is skipped) and splices them in at once */
+    void deallocateBulk(pointer* chunks, const std::size_t n_chunks) {
+        Chunk* first_chunk = nullptr;
+        Chunk* last_chunk = nullptr;
+        std::size_t n_freed = 0;
 
-            // freeing current object pool
-            delete current_object_pool;
+        for (std::size_t chunk_index = 0; chunk_index < n_chunks; ++chunk_index) {
+            if (chunk_index + m_bulk_prefetch_distance < n_chunks) {
+                __builtin_prefetch(chunks[chunk_index + m_bulk_prefetch_distance], 1);
+            }
+
+            Chunk* current_chunk = reinterpret_cast<Chunk*>(chunks[chunk_index]);
+            if (current_chunk == nullptr) {
+                continue;
+            }
+
+            if (last_chunk != nullptr) {
+                last_chunk->m_next = current_chunk;
+            } else {
+                first_chunk = current_chunk;
+            }
+            last_chunk = current_chunk;
+            ++n_freed;
         }
 
-#ifdef DEBUG
-        fclose(m_log_stream);
-#endif  // DEBUG
+        if (first_chunk == nullptr) {
+            return;
+        }
+
+        m_telemetry.deallocate(first_chunk, n_freed, PoolEventType::deallocate_bulk);
+
+#ifdef POOL_LOCK_FREE
+        m_free_blocks.pushChain(first_chunk, last_chunk);
+#else
+        last_chunk->m_next = m_free_blocks_head;
+        m_free_blocks_head = first_chunk;
+#endif  // POOL_LOCK_FREE
+    }
+
+    /* links in an ObjectPool of n_chunks chunks and frees all of them, so
+     * the next n_chunks allocations need no further block. The block is at
+     * least as large as asked, past the largest block of the pool if need be */
+    void reserve(const std::size_t n_chunks) {
+        if (n_chunks == 0) {
+            return;
+        }
+
+        std::size_t pool_chunks = ObjectPool::fittedChunks(n_chunks);
+
+#ifdef POOL_LOCK_FREE
+        ObjectPool* reserved_pool = ObjectPool::create(m_head_pool.load(), pool_chunks);
+        while (!m_head_pool.compare_exchange_weak(reserved_pool->m_next, reserved_pool)) {
+        }
+#else
+        ObjectPool* reserved_pool = nullptr;
+        if (m_head_pool == nullptr) {
+            reserved_pool = m_head_pool = ObjectPool::create(nullptr, pool_chunks);
+            m_blocks_in_pool = m_head_pool_chunks = pool_chunks;
+        } else {
+            // the head pool is the one allocate() carves from
+            reserved_pool = ObjectPool::create(m_head_pool->m_next, pool_chunks);
+            m_head_pool->m_next = reserved_pool;
+        }
+#endif  // POOL_LOCK_FREE
+
+        m_telemetry.linkBlock(reserved_pool, pool_chunks, ObjectPool::blockBytes(pool_chunks));
+        m_telemetry.carve(pool_chunks);
+
+        for (std::size_t chunk_index = 0; chunk_index + 1 < pool_chunks; ++chunk_index) {
+            reinterpret_cast<Chunk*>(reserved_pool->recieve_chunk(chunk_index))->m_next =
+                reinterpret_cast<Chunk*>(reserved_pool->recieve_chunk(chunk_index + 1));
+        }
+
+        Chunk* first_chunk = reinterpret_cast<Chunk*>(reserved_pool->recieve_chunk(0));
+        Chunk* last_chunk =
+            reinterpret_cast<Chunk*>(reserved_pool->recieve_chunk(pool_chunks - 1));
+
+#ifdef POOL_LOCK_FREE
+        m_free_blocks.pushChain(first_chunk, last_chunk);
+#else
+        last_chunk->m_next = m_free_blocks_head;
+        m_free_blocks_head = first_chunk;
+#endif  // POOL_LOCK_FREE
+    }
+
+    /* deletes the ObjectPools with no chunk in use but spare_pools of them,
+     * returns the bytes released. Nothing else may use the pool meanwhile,
+     * not even with POOL_LOCK_FREE */
+    std::size_t trim(const std::size_t spare_pools = 0) {
+#ifdef POOL_LOCK_FREE
+        Chunk* free_chunk = m_free_blocks.popAll();
+        ObjectPool* object_pool = m_head_pool.exchange(nullptr);
+
+        // every pool is carved whole
+        ObjectPool* bump_pool = nullptr;
+#else
+        Chunk* free_chunk = m_free_blocks_head;
+        ObjectPool* object_pool = m_head_pool;
+        m_free_blocks_head = nullptr;
+        m_head_pool = nullptr;
+
+        // the head pool is carved up to m_blocks_in_pool
+        ObjectPool* bump_pool = object_pool;
+#endif  // POOL_LOCK_FREE
+
+        // with both lists in address order, the free chunks of a pool are
+        // the ones below its end not taken by an earlier pool
+        free_chunk = sortByAddress(free_chunk);
+        object_pool = sortByAddress(object_pool);
+
+        Chunk* kept_chunks = nullptr;
+        Chunk** kept_chunks_tail = &kept_chunks;
+        Chunk* last_kept_chunk = nullptr;
+
+        ObjectPool* kept_pools = nullptr;
+        bool bump_pool_kept = false;
+
+        std::size_t spare_left = spare_pools;
+        std::size_t released_bytes = 0;
+
+        while (object_pool != nullptr) {
+            ObjectPool* next_pool = object_pool->m_next;
+            uint8_t* pool_end = object_pool->bufferEnd();
+
+            Chunk* pool_chunks = free_chunk;
+            std::size_t free_chunks = 0;
+            while (free_chunk != nullptr &&
+                   reinterpret_cast<uint8_t*>(free_chunk) < pool_end) {
+                ++free_chunks;
+                free_chunk = free_chunk->m_next;
+            }
+
+            std::size_t carved_chunks =
+                object_pool == bump_pool ? m_blocks_in_pool : object_pool->m_chunks;
+
+            bool unused = free_chunks == carved_chunks;
+            if (unused && spare_left == 0) {
+                released_bytes += ObjectPool::blockBytes(object_pool->m_chunks);
+                m_telemetry.releaseBlock(object_pool, object_pool->m_chunks, carved_chunks,
+                                         ObjectPool::blockBytes(object_pool->m_chunks));
+                ObjectPool::destroy(object_pool);
+            } else {
+                spare_left -= unused ? 1 : 0;
+
+                if (free_chunks != 0) {
+                    *kept_chunks_tail = pool_chunks;
+                    for (std::size_t chunk_index = 1; chunk_index < free_chunks;
+                         ++chunk_index) {
+                        pool_chunks = pool_chunks->m_next;
+                    }
+                    last_kept_chunk = pool_chunks;
+                    kept_chunks_tail = &pool_chunks->m_next;
+                }
+
+                if (object_pool == bump_pool) {
+                    bump_pool_kept = true;
+                } else {
+                    object_pool->m_next = kept_pools;
+                    kept_pools = object_pool;
+                }
+            }
+
+            object_pool = next_pool;
+        }
+
+        *kept_chunks_tail = nullptr;
+
+        // the pool allocate() carves from has to stay at the head
+        if (bump_pool_kept) {
+            bump_pool->m_next = kept_pools;
+            kept_pools = bump_pool;
+        } else {
+            m_blocks_in_pool = m_head_pool_chunks = 0;
+        }
+
+#ifdef POOL_LOCK_FREE
+        m_head_pool.store(kept_pools);
+        if (kept_chunks != nullptr) {
+            m_free_blocks.pushChain(kept_chunks, last_kept_chunk);
+        }
+#else
+        m_head_pool = kept_pools;
+        m_free_blocks_head = kept_chunks;
+        (void)last_kept_chunk;
+#endif  // POOL_LOCK_FREE
+
+        return released_bytes;
     }
 
     /* MOVE-SEMANTICS ARE COMPLETELY PROHIBITED FOR MemPool */
@@ -169,14 +464,216 @@ class MemPool {
     MemPool operator=(const MemPool& MemPool) = delete;
 
    private:
+    // chunks deallocateBulk() prefetches ahead of the one it links
+    static const std::size_t m_bulk_prefetch_distance = 8;
+
+#ifdef POOL_LOCK_FREE
+    /* every thread that finds the free list empty links in an ObjectPool of
+     * its own, takes up to n_chunks of it and shares the rest with a single
+     * push. Returns the chunks taken */
+    std::size_t carvePool(const std::size_t n_chunks, pointer* chunks) {
+        // racing threads may grow the next size once each, it stays capped
+        std::size_t pool_chunks =
+            ObjectPool::fittedChunks(m_next_pool_chunks.load(std::memory_order_relaxed));
+        m_next_pool_chunks.store(std::min(pool_chunks * POOL_BLOCK_GROWTH, m_max_chunks),
+                                 std::memory_order_relaxed);
+
+        ObjectPool* new_pool = ObjectPool::create(m_head_pool.load(), pool_chunks);
+        while (!m_head_pool.compare_exchange_weak(new_pool->m_next, new_pool)) {
+        }
+
+        // all of it goes to the caller and the free list at once
+        m_telemetry.linkBlock(new_pool, pool_chunks, ObjectPool::blockBytes(pool_chunks));
+        m_telemetry.carve(pool_chunks);
+
+        std::size_t n_taken = std::min(n_chunks, pool_chunks);
+        for (std::size_t chunk_index = 0; chunk_index < n_taken; ++chunk_index) {
+            chunks[chunk_index] = new_pool->recieve_chunk(chunk_index);
+        }
+
+        if (n_taken < pool_chunks) {
+            for (std::size_t chunk_index = n_taken; chunk_index < pool_chunks - 1;
+                 ++chunk_index) {
+                reinterpret_cast<Chunk*>(new_pool->recieve_chunk(chunk_index))
+                    ->m_next =
+                    reinterpret_cast<Chunk*>(new_pool->recieve_chunk(chunk_index + 1));
+            }
+
+            m_free_blocks.pushChain(
+                reinterpret_cast<Chunk*>(new_pool->recieve_chunk(n_taken)),
+                reinterpret_cast<Chunk*>(new_pool->recieve_chunk(pool_chunks - 1)));
+        }
+
+        return n_taken;
+    }
+
+    TaggedStack<Chunk> m_free_blocks;
+    std::atomic<ObjectPool*> m_head_pool{nullptr};
+
+    std::size_t m_max_chunks;
+    std::atomic<std::size_t> m_next_pool_chunks;
+#else
+    /* links in the next ObjectPool to carve chunks from */
+    void linkPool() {
+        std::size_t pool_chunks = ObjectPool::fittedChunks(m_next_pool_chunks);
+        m_head_pool = ObjectPool::create(m_head_pool, pool_chunks);
+        m_telemetry.linkBlock(m_head_pool, pool_chunks, ObjectPool::blockBytes(pool_chunks));
+
+        // no blocks in new pool yet
+        m_blocks_in_pool = 0;
+        m_head_pool_chunks = pool_chunks;
+        m_next_pool_chunks = std::min(pool_chunks * POOL_BLOCK_GROWTH, m_max_chunks);
+    }
+
     Chunk* m_free_blocks_head{nullptr};
     ObjectPool* m_head_pool{nullptr};
 
-    std::size_t m_blocks_in_pool{chunksPerBlock};
+    std::size_t m_max_chunks;
+    std::size_t m_next_pool_chunks;
+#endif  // POOL_LOCK_FREE
+
+    // chunks carved from and held by the head pool, see linkPool()
+    std::size_t m_blocks_in_pool{0};
+    std::size_t m_head_pool_chunks{0};
+
+    PoolTelemetry m_telemetry{this};
 };
 
-template <typename T, std::size_t chunksPerBlock = DEFAULT_CHUNKS_PER_BLOCK>
-class PoolAllocator : private MemPool<T, chunksPerBlock> {
+/* chunk interface of MagazineCache (magazine_cache.hpp) */
+template <typename T, std::size_t chunksPerBlock>
+void* chunkAllocate(MemPool<T, chunksPerBlock>& pool, const std::size_t) {
+    return pool.allocate();
+}
+
+template <typename T, std::size_t chunksPerBlock>
+void chunkDeallocate(MemPool<T, chunksPerBlock>& pool, void* chunk,
+                     const std::size_t) {
+    pool.deallocate(reinterpret_cast<T*>(chunk));
+}
+
+// runs of up to POOL_RUN_MAX_BYTES come from pools of runs of 2, 4, 8, ...
+// elements, longer ones from the upstream allocator
+static const std::size_t POOL_RUN_MAX_BYTES = 4096;
+static const std::size_t POOL_RUN_CLASSES = 12;
+// blocks of run pools hold at least this many runs
+static const std::size_t POOL_MIN_RUN_CHUNKS = 8;
+
+/* storage handed out by a sized pool */
+template <std::size_t Bytes, std::size_t Align>
+struct alignas(Align) PoolSlot {
+    uint8_t m_bytes[Bytes];
+};
+
+class SizedPoolBase {
+   public:
+    virtual ~SizedPoolBase() = default;
+
+    virtual void* allocate() = 0;
+    virtual void deallocate(void* chunk) = 0;
+};
+
+/* MemPool of Bytes-sized chunks */
+template <std::size_t Bytes, std::size_t Align, std::size_t chunksPerBlock>
+class SizedPool : public SizedPoolBase {
+   public:
+    void* allocate() override { return m_pool.allocate(); }
+
+    void deallocate(void* chunk) override {
+        m_pool.deallocate(reinterpret_cast<PoolSlot<Bytes, Align>*>(chunk));
+    }
+
+   private:
+    MemPool<PoolSlot<Bytes, Align>, chunksPerBlock> m_pool;
+};
+
+/* lock of the synchronized resources, none for the unsynchronized ones */
+template <bool Synchronized>
+struct ResourceLock {
+    explicit ResourceLock(std::mutex&) {}
+};
+
+template <>
+struct ResourceLock<true> : std::lock_guard<std::mutex> {
+    using std::lock_guard<std::mutex>::lock_guard;
+};
+
+#ifdef POOL_LOCK_FREE
+// MemPool takes care of its threads itself
+static const bool POOL_REGISTRY_LOCKED = false;
+#else
+static const bool POOL_REGISTRY_LOCKED = true;
+#endif  // POOL_LOCK_FREE
+
+/* the pools of PoolAllocator keyed by chunk size and alignment, so any
+ * element type, node type or run of the same size shares one pool */
+class PoolRegistry {
+   public:
+    typedef ResourceLock<POOL_REGISTRY_LOCKED> PoolLock;
+
+   public:
+    PoolRegistry() = default;
+
+    ~PoolRegistry() {
+        for (Entry& entry : m_entries) {
+            delete entry.m_pool;
+        }
+    }
+
+    /* POOLS ARE OWNED BY THE REGISTRY, COPY AND MOVE ARE PROHIBITED */
+    PoolRegistry(const PoolRegistry& other) = delete;
+    PoolRegistry& operator=(const PoolRegistry& other) = delete;
+
+    template <std::size_t Bytes, std::size_t Align, std::size_t chunksPerBlock>
+    SizedPoolBase* pool() {
+        std::lock_guard<std::mutex> entries_lock(m_entries_mutex);
+
+        for (Entry& entry : m_entries) {
+            if (entry.m_bytes == Bytes && entry.m_align == Align) {
+                return entry.m_pool;
+            }
+        }
+
+        m_entries.push_back(
+            Entry{Bytes, Align, new SizedPool<Bytes, Align, chunksPerBlock>()});
+        return m_entries.back().m_pool;
+    }
+
+    /* registry of every default-constructed PoolAllocator, so their
+     * containers compare equal and can splice and merge. Allocators keep it
+     * alive past static destruction */
+    static const std::shared_ptr<PoolRegistry>& defaultRegistry() {
+        static const std::shared_ptr<PoolRegistry> default_registry =
+            std::make_shared<PoolRegistry>();
+        return default_registry;
+    }
+
+    /* held around allocate() and deallocate() of the pools when allocators
+     * on several threads may share them, see PoolLock */
+    std::mutex& poolMutex() { return m_pools_mutex; }
+
+   private:
+    struct Entry {
+        std::size_t m_bytes;
+        std::size_t m_align;
+        SizedPoolBase* m_pool;
+    };
+
+    std::mutex m_entries_mutex;
+    std::vector<Entry> m_entries;
+
+    std::mutex m_pools_mutex;
+};
+
+/* single elements come from a pool of sizeof(T) chunks, runs of up to
+ * POOL_RUN_MAX_BYTES from pools of runs of 2, 4, 8, ... elements, so the
+ * allocator backs node-based and contiguous containers alike. Longer runs go
+ * to Upstream. Default-constructed allocators, their copies and rebinds
+ * share one registry of pools, reference counted, so a
+ * std::map<K, V, less, PoolAllocator<...>> gets its nodes from the pool of
+ * the node size and two pooled containers can splice */
+template <typename T, std::size_t chunksPerBlock = DEFAULT_CHUNKS_PER_BLOCK,
+          typename Upstream = std::allocator<T>>
+class PoolAllocator {
    public:
     /* TYPEDEFS */
     typedef T value_type;
@@ -186,76 +683,85 @@ class PoolAllocator : private MemPool<T, chunksPerBlock> {
     typedef const value_type& const_reference;
     typedef std::size_t size_type;
     typedef std::ptrdiff_t difference_type;
+    typedef typename std::allocator_traits<Upstream>::template rebind_alloc<T>
+        upstream_type;
+
+    // memory goes with the pools it came from
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
     /* END OF TYPEDEFS */
 
    public:
     template <typename U>
     struct rebind {
-        typedef PoolAllocator<U, chunksPerBlock> other;
+        typedef PoolAllocator<
+            U, chunksPerBlock,
+            typename std::allocator_traits<Upstream>::template rebind_alloc<U>>
+            other;
     };
 
    public:
-    inline explicit PoolAllocator() = default;
+    inline explicit PoolAllocator(const upstream_type& upstream = upstream_type())
+        : m_registry(PoolRegistry::defaultRegistry()), m_upstream(upstream) {}
 
-    inline ~PoolAllocator() {
-        if (m_rebind_allocator != nullptr) {
-            // free previously allocated memory
-            delete m_rebind_allocator;
-        }
-    }
-
-    inline explicit PoolAllocator(PoolAllocator const& other)
-        : m_cp_allocator(other) {}
+    // a copy frees what the original allocated, so they share the pools
+    inline PoolAllocator(PoolAllocator const& other) = default;
 
+    // the node allocator a container rebinds to shares the pools as well,
+    // its nodes get the pool of their size
     template <typename U>
-    inline explicit PoolAllocator(
-        PoolAllocator<U, chunksPerBlock> const& other) {
-        if (!std::is_same<T, U>::value == false) {
-            m_rebind_allocator = new std::allocator<T>();
-        }
-    }
+    inline PoolAllocator(
+        PoolAllocator<U, chunksPerBlock,
+                      typename std::allocator_traits<Upstream>::template rebind_alloc<U>> const&
+            other)
+        : m_registry(other.m_registry), m_upstream(other.m_upstream) {}
 
     //    address
     inline pointer address(reference r) { return &r; }
     inline const_pointer address(const_reference r) { return &r; }
 
     //    memory allocation
-    inline pointer allocate(
-        size_type cnt,
-        typename std::allocator<void>::const_pointer mem_ptr = 0) {
-        if (m_cp_allocator != nullptr) {
-            return m_cp_allocator->allocate(cnt, mem_ptr);
+    inline pointer allocate(size_type cnt, const void* = nullptr) {
+        if (cnt > max_size()) {
+            throw std::bad_alloc();
         }
 
-        if (m_rebind_allocator != nullptr) {
-            return m_rebind_allocator->allocate(cnt, mem_ptr);
+        if (cnt > m_max_run) {
+            return std::allocator_traits<upstream_type>::allocate(m_upstream, cnt);
         }
 
-        // main body of function that is called if there are no rebind and copy
-        // allocators
+        // the hint means nothing to a pool
+        SizedPoolBase* sized_pool = pool(cnt);
+        PoolRegistry::PoolLock pool_lock(m_registry->poolMutex());
 
-        if (cnt != 1 || mem_ptr != nullptr) {
-            throw std::bad_alloc();
-        } else {
-            return MemPool<T, chunksPerBlock>::allocate();
-        }
+        return reinterpret_cast<pointer>(sized_pool->allocate());
     }
 
     inline void deallocate(pointer ptr, size_type cnt) {
-        if (m_cp_allocator != nullptr) {
-            m_cp_allocator->deallocate(ptr, cnt);
+        if (ptr == nullptr) {
             return;
         }
 
-        if (m_rebind_allocator != nullptr) {
-            m_rebind_allocator->deallocate(ptr, cnt);
+        if (cnt > m_max_run) {
+            std::allocator_traits<upstream_type>::deallocate(m_upstream, ptr, cnt);
             return;
         }
 
-        // main body of function that is called if there are no rebind and copy
-        // allocators
+        SizedPoolBase* sized_pool = pool(cnt);
+        PoolRegistry::PoolLock pool_lock(m_registry->poolMutex());
 
-        MemPool<T, chunksPerBlock>::deallocate(ptr);
+        sized_pool->deallocate(ptr);
+    }
+
+    /* a run grows in place up to the length of its class, see
+     * has_try_expand in X17Vector.hpp */
+    inline bool try_expand(pointer ptr, size_type old_cnt, size_type new_cnt) {
+        if (ptr == nullptr || old_cnt <= 1 || new_cnt > m_max_run) {
+            return false;
+        }
+
+        return runClass(new_cnt) == runClass(old_cnt);
     }
 
     inline size_type max_size() const {
@@ -266,14 +772,241 @@ class PoolAllocator : private MemPool<T, chunksPerBlock> {
     inline void construct(pointer p, const T& t) { new (p) T(t); }
     inline void destroy(pointer p) { p->~T(); }
 
-    inline bool operator==(PoolAllocator const&) { return true; }
-    inline bool operator!=(PoolAllocator const& a) { return !operator==(a); }
+    // equal allocators free each other's memory
+    inline bool operator==(PoolAllocator const& other) const {
+        return m_registry == other.m_registry;
+    }
+    inline bool operator!=(PoolAllocator const& a) const { return !operator==(a); }
+
+    template <typename U, typename UpstreamU>
+    inline bool operator==(PoolAllocator<U, chunksPerBlock, UpstreamU> const& other) const {
+        return m_registry == other.m_registry;
+    }
+    template <typename U, typename UpstreamU>
+    inline bool operator!=(PoolAllocator<U, chunksPerBlock, UpstreamU> const& a) const {
+        return !operator==(a);
+    }
+
+   private:
+    /* runs of 2^k elements for k in [1, m_run_classes] */
+    static constexpr std::size_t runClasses() {
+        std::size_t run_classes = 0;
+        while (run_classes < POOL_RUN_CLASSES &&
+               (sizeof(T) << (run_classes + 1)) <= POOL_RUN_MAX_BYTES) {
+            ++run_classes;
+        }
+
+        return run_classes;
+    }
+
+    static const std::size_t m_run_classes = runClasses();
+    static const std::size_t m_max_run = (std::size_t)1 << m_run_classes;
+
+    /* k of the shortest run of 2^k elements holding cnt (1 < cnt <= m_max_run) */
+    static std::size_t runClass(const size_type cnt) {
+        return 64 - __builtin_clzll(cnt - 1);
+    }
+
+    inline SizedPoolBase* pool(const size_type cnt) {
+        std::size_t run_class = cnt <= 1 ? 0 : runClass(cnt);
+
+        if (m_pools[run_class] == nullptr) {
+            m_pools[run_class] =
+                registerPool(run_class, std::make_index_sequence<m_run_classes + 1>());
+        }
+
+        return m_pools[run_class];
+    }
+
+    template <std::size_t... RunClasses>
+    SizedPoolBase* registerPool(const std::size_t run_class,
+                                std::index_sequence<RunClasses...>) {
+        SizedPoolBase* sized_pool = nullptr;
+
+        // blocks of a run pool keep about the bytes of a block of elements
+        ((run_class == RunClasses
+              ? (void)(sized_pool = m_registry->template pool<
+                           (sizeof(T) << RunClasses), alignof(T),
+                           std::max(chunksPerBlock >> RunClasses, POOL_MIN_RUN_CHUNKS)>())
+              : (void)0),
+         ...);
+
+        return sized_pool;
+    }
 
    private:
-    PoolAllocator* m_cp_allocator;
-    std::allocator<T>* m_rebind_allocator;
+    template <typename U, std::size_t, typename>
+    friend class PoolAllocator;
+
+    // shared by copies and rebinds, the pools go with the last of them
+    std::shared_ptr<PoolRegistry> m_registry;
+    // pools of m_registry by run class, 0 for single elements
+    SizedPoolBase* m_pools[m_run_classes + 1] = {};
+
+    upstream_type m_upstream;
 };  //    end of class PoolAllocator
 
+/* largest power of two up to alignof(std::max_align_t) dividing Bytes, so
+ * consecutive chunks keep it */
+constexpr std::size_t resourceAlignment(const std::size_t bytes) {
+    std::size_t alignment = alignof(std::max_align_t);
+    while (bytes % alignment != 0) {
+        alignment >>= 1;
+    }
+
+    return alignment;
+}
+
+/* std::pmr adapter of a MemPool of Bytes-sized chunks. Larger or more
+ * aligned requests go to upstream. Synchronized takes a lock around the
+ * pool, so one resource can serve several threads */
+template <std::size_t Bytes, std::size_t chunksPerBlock = DEFAULT_CHUNKS_PER_BLOCK,
+          bool Synchronized = false>
+class MemPoolResource : public std::pmr::memory_resource {
+    typedef PoolSlot<Bytes, resourceAlignment(Bytes)> Slot;
+
+   public:
+    explicit MemPoolResource(
+        std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+        : m_upstream(upstream) {}
+
+    /* RESOURCES OWN THEIR POOL, COPY AND MOVE ARE PROHIBITED */
+    MemPoolResource(const MemPoolResource& other) = delete;
+    MemPoolResource& operator=(const MemPoolResource& other) = delete;
+
+    std::pmr::memory_resource* upstream_resource() const { return m_upstream; }
+
+   private:
+    void* do_allocate(std::size_t n_bytes, std::size_t alignment) override {
+        if (n_bytes > sizeof(Slot) || alignment > alignof(Slot)) {
+            return m_upstream->allocate(n_bytes, alignment);
+        }
+
+        ResourceLock<Synchronized> lock(m_mutex);
+        return m_pool.allocate();
+    }
+
+    void do_deallocate(void* mem_ptr, std::size_t n_bytes, std::size_t alignment) override {
+        if (n_bytes > sizeof(Slot) || alignment > alignof(Slot)) {
+            m_upstream->deallocate(mem_ptr, n_bytes, alignment);
+            return;
+        }
+
+        ResourceLock<Synchronized> lock(m_mutex);
+        m_pool.deallocate(reinterpret_cast<Slot*>(mem_ptr));
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+   private:
+    std::mutex m_mutex;
+    MemPool<Slot, chunksPerBlock> m_pool;
+
+    std::pmr::memory_resource* m_upstream;
+};
+
+template <std::size_t Bytes, std::size_t chunksPerBlock = DEFAULT_CHUNKS_PER_BLOCK>
+using SynchronizedMemPoolResource = MemPoolResource<Bytes, chunksPerBlock, true>;
+
+// size classes of SizeClassPoolResource: 16, 32, 64, ... POOL_RUN_MAX_BYTES
+static const std::size_t RESOURCE_MIN_CLASS_BYTES = 16;
+static const std::size_t RESOURCE_CLASSES = 9;
+
+/* std::pmr resource of MemPools by power-of-two size class, the general
+ * purpose resource of a component. A class gets its pool on first use,
+ * requests above POOL_RUN_MAX_BYTES or aligned beyond
+ * alignof(std::max_align_t) go to upstream, e.g. a HeapResource or an
+ * ArenaResource */
+template <std::size_t chunksPerBlock = DEFAULT_CHUNKS_PER_BLOCK, bool Synchronized = false>
+class SizeClassPoolResource : public std::pmr::memory_resource {
+    static_assert(RESOURCE_MIN_CLASS_BYTES << (RESOURCE_CLASSES - 1) == POOL_RUN_MAX_BYTES,
+                  "size classes must end at POOL_RUN_MAX_BYTES");
+
+   public:
+    explicit SizeClassPoolResource(
+        std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+        : m_upstream(upstream) {}
+
+    /* RESOURCES OWN THEIR POOLS, COPY AND MOVE ARE PROHIBITED */
+    SizeClassPoolResource(const SizeClassPoolResource& other) = delete;
+    SizeClassPoolResource& operator=(const SizeClassPoolResource& other) = delete;
+
+    std::pmr::memory_resource* upstream_resource() const { return m_upstream; }
+
+   private:
+    void* do_allocate(std::size_t n_bytes, std::size_t alignment) override {
+        if (n_bytes > POOL_RUN_MAX_BYTES || alignment > alignof(std::max_align_t)) {
+            return m_upstream->allocate(n_bytes, alignment);
+        }
+
+        ResourceLock<Synchronized> lock(m_mutex);
+        return pool(n_bytes)->allocate();
+    }
+
+    void do_deallocate(void* mem_ptr, std::size_t n_bytes, std::size_t alignment) override {
+        if (n_bytes > POOL_RUN_MAX_BYTES || alignment > alignof(std::max_align_t)) {
+            m_upstream->deallocate(mem_ptr, n_bytes, alignment);
+            return;
+        }
+
+        ResourceLock<Synchronized> lock(m_mutex);
+        pool(n_bytes)->deallocate(mem_ptr);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+    /* k of the class of 16 * 2^k bytes holding n_bytes */
+    static std::size_t sizeClass(const std::size_t n_bytes) {
+        if (n_bytes <= RESOURCE_MIN_CLASS_BYTES) {
+            return 0;
+        }
+
+        return 64 - __builtin_clzll((n_bytes - 1) / RESOURCE_MIN_CLASS_BYTES);
+    }
+
+    SizedPoolBase* pool(const std::size_t n_bytes) {
+        std::size_t size_class = sizeClass(n_bytes);
+
+        if (m_pools[size_class] == nullptr) {
+            m_pools[size_class] =
+                registerPool(size_class, std::make_index_sequence<RESOURCE_CLASSES>());
+        }
+
+        return m_pools[size_class];
+    }
+
+    template <std::size_t... SizeClasses>
+    SizedPoolBase* registerPool(const std::size_t size_class,
+                                std::index_sequence<SizeClasses...>) {
+        SizedPoolBase* sized_pool = nullptr;
+
+        // blocks of a class keep about the bytes of a block of the smallest one
+        ((size_class == SizeClasses
+              ? (void)(sized_pool = m_registry.template pool<
+                           (RESOURCE_MIN_CLASS_BYTES << SizeClasses),
+                           alignof(std::max_align_t),
+                           std::max(chunksPerBlock >> SizeClasses, POOL_MIN_RUN_CHUNKS)>())
+              : (void)0),
+         ...);
+
+        return sized_pool;
+    }
+
+   private:
+    std::mutex m_mutex;
+    PoolRegistry m_registry;
+    SizedPoolBase* m_pools[RESOURCE_CLASSES] = {};
+
+    std::pmr::memory_resource* m_upstream;
+};
+
+template <std::size_t chunksPerBlock = DEFAULT_CHUNKS_PER_BLOCK>
+using SynchronizedSizeClassPoolResource = SizeClassPoolResource<chunksPerBlock, true>;
+
 }  // namespace X17
 
 #endif  // !X17_POOL_ALLOC_STABLE
\ No newline at end of file
@@ -0,0 +1,175 @@
+////////////////////////////////////////////////////////////
+/// Headers
+////////////////////////////////////////////////////////////
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// both headers name their pool PoolAllocator, BENCH_MEMPOOL picks one
+#ifdef BENCH_MEMPOOL
+#include "pool_alloc_stl.hpp"
+#else
+#include "pool_alloc_nonstl.hpp"
+#endif  // BENCH_MEMPOOL
+#include "magazine_cache.hpp"
+
+/* threads allocate and free batches of chunks from one shared pool and
+ * from malloc. Built without POOL_LOCK_FREE the pool is wrapped in a mutex,
+ * built with it the pool is used as it is. The magazines column puts a
+ * MagazineCache in front of the pool:
+ *
+ *     g++ -std=c++17 -O2 -pthread pool_bench.cpp -o pool_bench_mutex
+ *     g++ -std=c++17 -O2 -pthread -DPOOL_LOCK_FREE pool_bench.cpp -o pool_bench_lock_free
+ *     ./pool_bench_lock_free [ops per thread]
+ *
+ * add -DBENCH_MEMPOOL to measure MemPool instead of the non-STL
+ * PoolAllocator */
+
+using namespace X17;
+
+static const size_t BENCH_CHUNK_BYTES = 32;
+static const size_t BENCH_BATCH = 64;
+static const size_t BENCH_OPS = 1 << 20;
+static const size_t BENCH_MAX_THREADS = 64;
+
+struct BenchChunk {
+    uint8_t m_data[BENCH_CHUNK_BYTES];
+};
+
+#ifdef POOL_LOCK_FREE
+// the pools are shared as they are
+struct BenchLock {
+    explicit BenchLock(std::mutex&) {}
+};
+#else
+typedef std::lock_guard<std::mutex> BenchLock;
+#endif  // POOL_LOCK_FREE
+
+#ifndef BENCH_MEMPOOL
+class PoolBackend {
+   public:
+    void* allocate() {
+        BenchLock lock(m_mutex);
+        return m_pool.allocate(BENCH_CHUNK_BYTES);
+    }
+
+    void deallocate(void* mem_ptr) {
+        BenchLock lock(m_mutex);
+        m_pool.deallocate(mem_ptr, BENCH_CHUNK_BYTES);
+    }
+
+   private:
+    std::mutex m_mutex;
+    PoolAllocator m_pool{1024};
+};
+#else
+class PoolBackend {
+   public:
+    void* allocate() {
+        BenchLock lock(m_mutex);
+        return m_pool.allocate();
+    }
+
+    void deallocate(void* mem_ptr) {
+        BenchLock lock(m_mutex);
+        m_pool.deallocate(reinterpret_cast<BenchChunk*>(mem_ptr));
+    }
+
+   private:
+    std::mutex m_mutex;
+    MemPool<BenchChunk, 1024> m_pool;
+};
+#endif  // !BENCH_MEMPOOL
+
+// the magazines reach the pool through its backend
+void* chunkAllocate(PoolBackend& pool, const size_t) { return pool.allocate(); }
+
+void chunkDeallocate(PoolBackend& pool, void* chunk, const size_t) {
+    pool.deallocate(chunk);
+}
+
+class MagazineBackend {
+   public:
+    void* allocate() { return m_cache.allocate(); }
+    void deallocate(void* mem_ptr) { m_cache.deallocate(mem_ptr); }
+
+   private:
+    PoolBackend m_pool;
+    MagazineCache<PoolBackend> m_cache{m_pool, BENCH_CHUNK_BYTES};
+};
+
+class MallocBackend {
+   public:
+    void* allocate() { return std::malloc(BENCH_CHUNK_BYTES); }
+    void deallocate(void* mem_ptr) { std::free(mem_ptr); }
+};
+
+/* millions of allocate + deallocate pairs per second */
+template <typename Backend>
+double runBench(const size_t n_threads, const size_t n_ops) {
+    Backend backend;
+
+    auto worker = [&backend, n_ops]() {
+        void* batch[BENCH_BATCH];
+
+        for (size_t op = 0; op < n_ops; op += BENCH_BATCH) {
+            for (size_t i = 0; i < BENCH_BATCH; ++i) {
+                batch[i] = backend.allocate();
+                // touch the chunk like a real user would
+                *reinterpret_cast<volatile uint8_t*>(batch[i]) = (uint8_t)i;
+            }
+
+            for (size_t i = 0; i < BENCH_BATCH; ++i) {
+                backend.deallocate(batch[i]);
+            }
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (size_t thread_idx = 0; thread_idx < n_threads; ++thread_idx) {
+        threads.emplace_back(worker);
+    }
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    return (double)(n_threads * n_ops) / seconds / 1e6;
+}
+
+int main(int argc, char* argv[]) {
+    size_t n_ops = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : BENCH_OPS;
+
+#ifdef BENCH_MEMPOOL
+    const char* pool_name = "MemPool";
+#else
+    const char* pool_name = "PoolAllocator";
+#endif  // BENCH_MEMPOOL
+
+#ifdef POOL_LOCK_FREE
+    const char* sync_name = "lock-free";
+#else
+    const char* sync_name = "mutex";
+#endif  // POOL_LOCK_FREE
+
+    printf("%s (%s), %zu-byte chunks, Mops/s\n", pool_name, sync_name,
+           BENCH_CHUNK_BYTES);
+    printf("%8s %14s %14s %14s\n", "threads", "pool", "magazines", "malloc");
+
+    for (size_t n_threads = 1; n_threads <= BENCH_MAX_THREADS; n_threads *= 2) {
+        printf("%8zu %14.1f %14.1f %14.1f\n", n_threads,
+               runBench<PoolBackend>(n_threads, n_ops),
+               runBench<MagazineBackend>(n_threads, n_ops),
+               runBench<MallocBackend>(n_threads, n_ops));
+    }
+
+    return 0;
+}
@@ -0,0 +1,121 @@
+#ifndef X17_POOL_BLOCKS
+#define X17_POOL_BLOCKS
+
+////////////////////////////////////////////////////////////
+/// Headers
+////////////////////////////////////////////////////////////
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+// PoolAllocator config file (modified by user)
+#include "config_pool.hpp"
+
+namespace X17 {
+
+static const size_t HUGE_PAGE_BYTES = 2 * 1024 * 1024;
+
+inline size_t mappedBlockBytes(const size_t n_bytes, const bool huge_pages) {
+    size_t page_bytes = huge_pages ? HUGE_PAGE_BYTES : (size_t)sysconf(_SC_PAGESIZE);
+    return (n_bytes + page_bytes - 1) & ~(page_bytes - 1);
+}
+
+/* maps a block straight from the OS. Huge pages come from the hugetlb pool
+ * if it has any, otherwise from a huge-page aligned mapping the kernel is
+ * asked to back with transparent huge pages. A prefaulted block has all its
+ * pages by the time it is returned, nullptr if nothing could be mapped */
+inline void* mapPages(const size_t n_bytes, const bool huge_pages, const bool prefault) {
+    size_t block_bytes = mappedBlockBytes(n_bytes, huge_pages);
+    int populate = prefault ? MAP_POPULATE : 0;
+
+    if (!huge_pages) {
+        void* block = mmap(nullptr, block_bytes, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | populate, -1, 0);
+        return block != MAP_FAILED ? block : nullptr;
+    }
+
+#ifdef MAP_HUGETLB
+    void* hugetlb_block = mmap(nullptr, block_bytes, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | populate,
+                               -1, 0);
+    if (hugetlb_block != MAP_FAILED) {
+        return hugetlb_block;
+    }
+#endif  // MAP_HUGETLB
+
+    // over-map, then cut the block out on a huge-page boundary
+    uint8_t* mapping = reinterpret_cast<uint8_t*>(
+        mmap(nullptr, block_bytes + HUGE_PAGE_BYTES, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (mapping == MAP_FAILED) {
+        return nullptr;
+    }
+
+    uint8_t* block = reinterpret_cast<uint8_t*>(
+        (reinterpret_cast<uintptr_t>(mapping) + HUGE_PAGE_BYTES - 1) &
+        ~(HUGE_PAGE_BYTES - 1));
+    if (block != mapping) {
+        munmap(mapping, block - mapping);
+    }
+    munmap(block + block_bytes, mapping + HUGE_PAGE_BYTES - block);
+
+#ifdef MADV_HUGEPAGE
+    madvise(block, block_bytes, MADV_HUGEPAGE);
+#endif  // MADV_HUGEPAGE
+
+    if (prefault) {
+        // MAP_POPULATE would fault small pages in before the advice
+#ifdef MADV_POPULATE_WRITE
+        if (madvise(block, block_bytes, MADV_POPULATE_WRITE) == 0) {
+            return block;
+        }
+#endif  // MADV_POPULATE_WRITE
+
+        for (size_t offset = 0; offset < block_bytes; offset += HUGE_PAGE_BYTES) {
+            reinterpret_cast<volatile uint8_t*>(block)[offset] = 0;
+        }
+    }
+
+    return block;
+}
+
+inline void unmapPages(void* block, const size_t n_bytes, const bool huge_pages) {
+    munmap(block, mappedBlockBytes(n_bytes, huge_pages));
+}
+
+#ifdef POOL_HUGE_PAGES
+static const bool POOL_BLOCK_HUGE_PAGES = true;
+#else
+static const bool POOL_BLOCK_HUGE_PAGES = false;
+#endif  // POOL_HUGE_PAGES
+
+#ifdef POOL_PREFAULT
+static const bool POOL_BLOCK_PREFAULT = true;
+#else
+static const bool POOL_BLOCK_PREFAULT = false;
+#endif  // POOL_PREFAULT
+
+/* block source and release of the pools: malloc, or whole (huge) pages
+ * mapped for the block with POOL_HUGE_PAGES or POOL_PREFAULT */
+inline void* allocateBlock(const size_t n_bytes) {
+#if defined(POOL_HUGE_PAGES) || defined(POOL_PREFAULT)
+    return mapPages(n_bytes, POOL_BLOCK_HUGE_PAGES, POOL_BLOCK_PREFAULT);
+#else
+    return std::malloc(n_bytes);
+#endif  // POOL_HUGE_PAGES || POOL_PREFAULT
+}
+
+inline void freeBlock(void* block, const size_t n_bytes) {
+#if defined(POOL_HUGE_PAGES) || defined(POOL_PREFAULT)
+    unmapPages(block, n_bytes, POOL_BLOCK_HUGE_PAGES);
+#else
+    (void)n_bytes;
+    std::free(block);
+#endif  // POOL_HUGE_PAGES || POOL_PREFAULT
+}
+
+};  // namespace X17
+
+#endif  // !X17_POOL_BLOCKS
@@ -0,0 +1,135 @@
+////////////////////////////////////////////////////////////
+/// Headers
+////////////////////////////////////////////////////////////
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "pool_alloc_nonstl.hpp"
+
+/* chases pointers through a random cycle of pool nodes to compare block
+ * backings: malloc, mapped small pages, and 2 MB huge pages, each with and
+ * without prefaulting. Build time includes the page faults of first touch:
+ *
+ *     g++ -std=c++17 -O2 pool_chase_bench.cpp -o pool_chase_bench
+ *     ./pool_chase_bench [nodes] [hops]
+ */
+
+using namespace X17;
+
+static const size_t CHASE_NODES = 4 * 1024 * 1024;
+static const size_t CHASE_HOPS = 16 * 1024 * 1024;
+
+struct ChaseNode {
+    ChaseNode* m_next;
+    uint64_t m_payload[7];
+};
+
+// a block of this many nodes and its header fill one huge page
+static const size_t CHASE_CHUNKS_PER_BLOCK =
+    (HUGE_PAGE_BYTES - sizeof(PoolBlock)) / sizeof(ChaseNode);
+
+void releaseMalloc(void* block, const size_t) { std::free(block); }
+
+void* smallPages(const size_t n_bytes) { return mapPages(n_bytes, false, false); }
+void* smallPagesPrefaulted(const size_t n_bytes) { return mapPages(n_bytes, false, true); }
+void* hugePages(const size_t n_bytes) { return mapPages(n_bytes, true, false); }
+void* hugePagesPrefaulted(const size_t n_bytes) { return mapPages(n_bytes, true, true); }
+
+void releaseSmallPages(void* block, const size_t n_bytes) {
+    unmapPages(block, n_bytes, false);
+}
+
+void releaseHugePages(void* block, const size_t n_bytes) {
+    unmapPages(block, n_bytes, true);
+}
+
+/* AnonHugePages of the process in KiB */
+size_t hugePagesInUse() {
+    FILE* smaps = fopen("/proc/self/smaps_rollup", "r");
+    if (smaps == nullptr) {
+        return 0;
+    }
+
+    char line[256];
+    size_t huge_kib = 0;
+    while (fgets(line, sizeof(line), smaps) != nullptr) {
+        if (strncmp(line, "AnonHugePages:", 14) == 0) {
+            huge_kib = strtoull(line + 14, nullptr, 10);
+        }
+    }
+
+    fclose(smaps);
+    return huge_kib;
+}
+
+void runChase(const char* name, PoolAllocator::BlockSource block_source,
+              PoolAllocator::BlockRelease block_release, const size_t n_nodes,
+              const size_t n_hops) {
+    PoolAllocator pool(CHASE_CHUNKS_PER_BLOCK, block_source, block_release);
+    std::vector<ChaseNode*> nodes(n_nodes);
+
+    auto build_start = std::chrono::steady_clock::now();
+    for (ChaseNode*& node : nodes) {
+        node = reinterpret_cast<ChaseNode*>(pool.allocate(sizeof(ChaseNode)));
+        node->m_payload[0] = 1;
+    }
+    double build_ns = std::chrono::duration<double, std::nano>(
+                          std::chrono::steady_clock::now() - build_start)
+                          .count();
+
+    // one random cycle through every node
+    std::vector<size_t> order(n_nodes);
+    for (size_t node_idx = 0; node_idx < n_nodes; ++node_idx) {
+        order[node_idx] = node_idx;
+    }
+    std::shuffle(order.begin(), order.end(), std::mt19937_64(42));
+    for (size_t node_idx = 0; node_idx < n_nodes; ++node_idx) {
+        nodes[order[node_idx]]->m_next = nodes[order[(node_idx + 1) % n_nodes]];
+    }
+
+    ChaseNode* node = nodes[order[0]];
+    uint64_t sum = 0;
+
+    auto chase_start = std::chrono::steady_clock::now();
+    for (size_t hop = 0; hop < n_hops; ++hop) {
+        sum += node->m_payload[0];
+        node = node->m_next;
+    }
+    double chase_ns = std::chrono::duration<double, std::nano>(
+                          std::chrono::steady_clock::now() - chase_start)
+                          .count();
+
+    printf("%-22s %10.1f %10.1f %12zu\n", name, build_ns / n_nodes,
+           chase_ns / n_hops, hugePagesInUse() / 1024);
+
+    // every node was visited with its payload intact
+    if (sum != n_hops) {
+        printf("  broken cycle\n");
+    }
+
+    for (ChaseNode* node_to_free : nodes) {
+        pool.deallocate(node_to_free, sizeof(ChaseNode));
+    }
+}
+
+int main(int argc, char* argv[]) {
+    size_t n_nodes = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : CHASE_NODES;
+    size_t n_hops = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : CHASE_HOPS;
+
+    printf("%zu nodes of %zu bytes (%zu MiB), %zu hops\n", n_nodes, sizeof(ChaseNode),
+           n_nodes * sizeof(ChaseNode) >> 20, n_hops);
+    printf("%-22s %10s %10s %12s\n", "blocks", "build ns", "hop ns", "huge MiB");
+
+    runChase("malloc", std::malloc, releaseMalloc, n_nodes, n_hops);
+    runChase("small pages", smallPages, releaseSmallPages, n_nodes, n_hops);
+    runChase("small pages prefault", smallPagesPrefaulted, releaseSmallPages, n_nodes, n_hops);
+    runChase("huge pages", hugePages, releaseHugePages, n_nodes, n_hops);
+    runChase("huge pages prefault", hugePagesPrefaulted, releaseHugePages, n_nodes, n_hops);
+
+    return 0;
+}
@@ -0,0 +1,456 @@
+#ifndef X17_POOL_TELEMETRY
+#define X17_POOL_TELEMETRY
+
+////////////////////////////////////////////////////////////
+/// Headers
+////////////////////////////////////////////////////////////
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// PoolAllocator config file (modified by user)
+#include "config_pool.hpp"
+
+#ifdef POOL_ALLOC_DEBUG
+#define POOL_TELEMETRY
+#define POOL_TELEMETRY_EVENTS
+#endif  // POOL_ALLOC_DEBUG
+
+// the event log comes with the counters
+#if defined(POOL_TELEMETRY_EVENTS) && !defined(POOL_TELEMETRY)
+#define POOL_TELEMETRY
+#endif  // POOL_TELEMETRY_EVENTS && !POOL_TELEMETRY
+
+namespace X17 {
+
+// events a pool buffers between two drains, further ones are dropped
+static const std::size_t TELEMETRY_RING_EVENTS = 4096;
+// the background thread writes the rings out this often
+static const std::size_t TELEMETRY_DRAIN_MS = 50;
+
+static const char* const TELEMETRY_DIRECTORY = "alloc_logs";
+static const char* const TELEMETRY_FILENAME = "alloc_logs/mempool.events";
+
+enum class PoolEventType : uint32_t {
+    allocate,
+    deallocate,
+    allocate_bulk,
+    deallocate_bulk,
+    link_block,
+    release_block,
+};
+
+/* one record of the event log, written as it is (native byte order) */
+struct PoolEvent {
+    uint64_t m_time_ns;  // steady clock
+    uint64_t m_pool;
+    uint64_t m_address;  // chunk, first chunk of a bulk call or block
+    uint32_t m_type;     // PoolEventType
+    uint32_t m_count;    // chunks
+};
+
+/* counters of one pool at m_time_ns */
+struct PoolStats {
+    uint64_t m_time_ns;
+
+    uint64_t m_allocs;
+    uint64_t m_deallocs;
+    uint64_t m_live_chunks;
+    uint64_t m_peak_chunks;
+
+    uint64_t m_blocks;
+    uint64_t m_block_bytes;
+    // chunks on the free list: carved from a block, not in use
+    uint64_t m_free_chunks;
+
+    uint64_t m_dropped_events;
+};
+
+inline uint64_t telemetryNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/* allocations per second between two stats() of a pool */
+inline double allocsPerSecond(const PoolStats& earlier, const PoolStats& later) {
+    if (later.m_time_ns <= earlier.m_time_ns) {
+        return 0.0;
+    }
+
+    return (double)(later.m_allocs - earlier.m_allocs) * 1e9 /
+           (double)(later.m_time_ns - earlier.m_time_ns);
+}
+
+inline void printPoolStats(FILE* stream, const PoolStats& stats,
+                           const PoolStats* earlier = nullptr) {
+    fprintf(stream,
+            "live %llu (peak %llu), free %llu, blocks %llu (%llu bytes), allocs %llu, "
+            "deallocs %llu",
+            (unsigned long long)stats.m_live_chunks, (unsigned long long)stats.m_peak_chunks,
+            (unsigned long long)stats.m_free_chunks, (unsigned long long)stats.m_blocks,
+            (unsigned long long)stats.m_block_bytes, (unsigned long long)stats.m_allocs,
+            (unsigned long long)stats.m_deallocs);
+
+    if (earlier != nullptr) {
+        fprintf(stream, ", %.0f allocs/s", allocsPerSecond(*earlier, stats));
+    }
+
+    if (stats.m_dropped_events != 0) {
+        fprintf(stream, ", %llu events dropped",
+                (unsigned long long)stats.m_dropped_events);
+    }
+
+    fprintf(stream, "\n");
+}
+
+/* a counter written by the pool and read by anyone. Without POOL_LOCK_FREE
+ * the pool has a single writer, so a relaxed load and store do instead of a
+ * locked add */
+class TelemetryCounter {
+   public:
+    void add(const uint64_t n) {
+#ifdef POOL_LOCK_FREE
+        m_value.fetch_add(n, std::memory_order_relaxed);
+#else
+        m_value.store(m_value.load(std::memory_order_relaxed) + n,
+                      std::memory_order_relaxed);
+#endif  // POOL_LOCK_FREE
+    }
+
+    void raiseTo(const uint64_t n) {
+        uint64_t value = m_value.load(std::memory_order_relaxed);
+#ifdef POOL_LOCK_FREE
+        while (value < n &&
+               !m_value.compare_exchange_weak(value, n, std::memory_order_relaxed)) {
+        }
+#else
+        if (value < n) {
+            m_value.store(n, std::memory_order_relaxed);
+        }
+#endif  // POOL_LOCK_FREE
+    }
+
+    uint64_t load() const { return m_value.load(std::memory_order_relaxed); }
+
+   private:
+    std::atomic<uint64_t> m_value{0};
+};
+
+/* bounded multi-producer ring of events (a sequence number per slot). A
+ * full ring drops the event instead of making the pool wait */
+class EventRing {
+    struct Slot {
+        std::atomic<uint64_t> m_sequence;
+        PoolEvent m_event;
+    };
+
+   public:
+    EventRing() {
+        for (std::size_t slot_idx = 0; slot_idx < TELEMETRY_RING_EVENTS; ++slot_idx) {
+            m_slots[slot_idx].m_sequence.store(slot_idx, std::memory_order_relaxed);
+        }
+    }
+
+    void push(const PoolEvent& event) {
+        uint64_t position = m_head.load(std::memory_order_relaxed);
+
+        while (true) {
+            Slot& slot = m_slots[position % TELEMETRY_RING_EVENTS];
+            uint64_t sequence = slot.m_sequence.load(std::memory_order_acquire);
+
+            if (sequence == position) {
+                if (m_head.compare_exchange_weak(position, position + 1,
+                                                 std::memory_order_relaxed)) {
+                    slot.m_event = event;
+                    slot.m_sequence.store(position + 1, std::memory_order_release);
+                    return;
+                }
+            } else if (sequence < position) {
+                // a whole ring behind: the drain has not caught up
+                m_dropped.add(1);
+                return;
+            } else {
+                position = m_head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /* writes the pushed events to stream, by the drain thread only */
+    std::size_t drain(FILE* stream) {
+        PoolEvent events[64];
+        std::size_t n_drained = 0;
+
+        while (true) {
+            std::size_t n_events = 0;
+
+            while (n_events < 64) {
+                Slot& slot = m_slots[m_tail % TELEMETRY_RING_EVENTS];
+                if (slot.m_sequence.load(std::memory_order_acquire) != m_tail + 1) {
+                    break;
+                }
+
+                events[n_events++] = slot.m_event;
+                slot.m_sequence.store(m_tail + TELEMETRY_RING_EVENTS,
+                                      std::memory_order_release);
+                ++m_tail;
+            }
+
+            if (n_events == 0) {
+                return n_drained;
+            }
+
+            if (stream != nullptr) {
+                fwrite(events, sizeof(PoolEvent), n_events, stream);
+            }
+            n_drained += n_events;
+        }
+    }
+
+    uint64_t dropped() const { return m_dropped.load(); }
+
+   private:
+    alignas(64) std::atomic<uint64_t> m_head{0};
+    alignas(64) uint64_t m_tail{0};
+    TelemetryCounter m_dropped;
+
+    Slot m_slots[TELEMETRY_RING_EVENTS];
+};
+
+/* background thread writing the event rings of all pools to
+ * TELEMETRY_FILENAME, started by the first ring */
+class TelemetryDrain {
+   public:
+    static TelemetryDrain& instance() {
+        static TelemetryDrain drain;
+        return drain;
+    }
+
+    void attach(EventRing* ring) {
+        std::lock_guard<std::mutex> drain_lock(m_drain_mutex);
+        m_rings.push_back(ring);
+
+        if (!m_thread.joinable()) {
+            m_thread = std::thread(&TelemetryDrain::run, this);
+        }
+    }
+
+    /* the ring's pool is going, what it has left is written first */
+    void detach(EventRing* ring) {
+        std::lock_guard<std::mutex> drain_lock(m_drain_mutex);
+        ring->drain(m_stream);
+
+        for (std::size_t ring_idx = 0; ring_idx < m_rings.size(); ++ring_idx) {
+            if (m_rings[ring_idx] == ring) {
+                m_rings[ring_idx] = m_rings.back();
+                m_rings.pop_back();
+                break;
+            }
+        }
+    }
+
+    /* DRAIN IS UNIQUE, COPY AND MOVE ARE PROHIBITED */
+    TelemetryDrain(const TelemetryDrain& other) = delete;
+    TelemetryDrain& operator=(const TelemetryDrain& other) = delete;
+
+   private:
+    TelemetryDrain() {
+        std::error_code error;
+        std::filesystem::create_directories(TELEMETRY_DIRECTORY, error);
+
+        // without a file the events are still drained, just not kept
+        m_stream = fopen(TELEMETRY_FILENAME, "ab");
+    }
+
+    ~TelemetryDrain() {
+        {
+            std::lock_guard<std::mutex> drain_lock(m_drain_mutex);
+            m_stopping = true;
+        }
+        m_wakeup.notify_one();
+
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+
+        if (m_stream != nullptr) {
+            fclose(m_stream);
+        }
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> drain_lock(m_drain_mutex);
+
+        while (true) {
+            m_wakeup.wait_for(drain_lock, std::chrono::milliseconds(TELEMETRY_DRAIN_MS),
+                              [this]() { return m_stopping; });
+
+            for (EventRing* ring : m_rings) {
+                ring->drain(m_stream);
+            }
+
+            if (m_stream != nullptr) {
+                fflush(m_stream);
+            }
+
+            if (m_stopping) {
+                return;
+            }
+        }
+    }
+
+   private:
+    std::mutex m_drain_mutex;
+    std::condition_variable m_wakeup;
+    bool m_stopping{false};
+
+    std::vector<EventRing*> m_rings;
+    FILE* m_stream{nullptr};
+
+    std::thread m_thread;
+};
+
+/* telemetry of one pool: counters with POOL_TELEMETRY, the event log with
+ * POOL_TELEMETRY_EVENTS as well, nothing at all without them */
+class PoolTelemetry {
+   public:
+#ifdef POOL_TELEMETRY_EVENTS
+    explicit PoolTelemetry(const void* pool)
+        : m_pool(reinterpret_cast<uintptr_t>(pool)), m_ring(new EventRing()) {
+        TelemetryDrain::instance().attach(m_ring.get());
+    }
+
+    ~PoolTelemetry() { TelemetryDrain::instance().detach(m_ring.get()); }
+#else
+    explicit PoolTelemetry(const void*) {}
+#endif  // POOL_TELEMETRY_EVENTS
+
+    /* TELEMETRY BELONGS TO ITS POOL, COPY AND MOVE ARE PROHIBITED */
+    PoolTelemetry(const PoolTelemetry& other) = delete;
+    PoolTelemetry& operator=(const PoolTelemetry& other) = delete;
+
+    void allocate(const void* chunk, const std::size_t n_chunks = 1,
+                  const PoolEventType type = PoolEventType::allocate) {
+#ifdef POOL_TELEMETRY
+        m_allocs.add(n_chunks);
+
+        // other threads' deallocations may be seen before their allocations
+        uint64_t deallocs = m_deallocs.load();
+        uint64_t allocs = m_allocs.load();
+        if (allocs > deallocs) {
+            m_peak_chunks.raiseTo(allocs - deallocs);
+        }
+#endif  // POOL_TELEMETRY
+
+        record(type, chunk, n_chunks);
+    }
+
+    void deallocate(const void* chunk, const std::size_t n_chunks = 1,
+                    const PoolEventType type = PoolEventType::deallocate) {
+#ifdef POOL_TELEMETRY
+        m_deallocs.add(n_chunks);
+#endif  // POOL_TELEMETRY
+
+        record(type, chunk, n_chunks);
+    }
+
+    /* chunks leave the untouched part of a block, to a caller or the free
+     * list */
+    void carve(const std::size_t n_chunks) {
+#ifdef POOL_TELEMETRY
+        m_carved_chunks.add(n_chunks);
+#else
+        (void)n_chunks;
+#endif  // POOL_TELEMETRY
+    }
+
+    void linkBlock(const void* block, const std::size_t n_chunks, const std::size_t n_bytes) {
+#ifdef POOL_TELEMETRY
+        m_blocks.add(1);
+        m_block_bytes.add(n_bytes);
+#else
+        (void)n_bytes;
+#endif  // POOL_TELEMETRY
+
+        record(PoolEventType::link_block, block, n_chunks);
+    }
+
+    /* carved_chunks of the block were all free */
+    void releaseBlock(const void* block, const std::size_t n_chunks,
+                      const std::size_t carved_chunks, const std::size_t n_bytes) {
+#ifdef POOL_TELEMETRY
+        m_blocks.add((uint64_t)-1);
+        m_block_bytes.add((uint64_t)0 - n_bytes);
+        m_carved_chunks.add((uint64_t)0 - carved_chunks);
+#else
+        (void)carved_chunks;
+        (void)n_bytes;
+#endif  // POOL_TELEMETRY
+
+        record(PoolEventType::release_block, block, n_chunks);
+    }
+
+    PoolStats stats() const {
+        PoolStats stats{};
+
+#ifdef POOL_TELEMETRY
+        stats.m_time_ns = telemetryNow();
+
+        stats.m_allocs = m_allocs.load();
+        stats.m_deallocs = m_deallocs.load();
+        stats.m_live_chunks = stats.m_allocs - stats.m_deallocs;
+        stats.m_peak_chunks = m_peak_chunks.load();
+
+        stats.m_blocks = m_blocks.load();
+        stats.m_block_bytes = m_block_bytes.load();
+        stats.m_free_chunks = m_carved_chunks.load() - stats.m_live_chunks;
+#endif  // POOL_TELEMETRY
+
+#ifdef POOL_TELEMETRY_EVENTS
+        stats.m_dropped_events = m_ring->dropped();
+#endif  // POOL_TELEMETRY_EVENTS
+
+        return stats;
+    }
+
+   private:
+    void record(const PoolEventType type, const void* address, const std::size_t n_chunks) {
+#ifdef POOL_TELEMETRY_EVENTS
+        m_ring->push(PoolEvent{telemetryNow(), m_pool, reinterpret_cast<uintptr_t>(address),
+                              (uint32_t)type, (uint32_t)n_chunks});
+#else
+        (void)type;
+        (void)address;
+        (void)n_chunks;
+#endif  // POOL_TELEMETRY_EVENTS
+    }
+
+   private:
+#ifdef POOL_TELEMETRY
+    TelemetryCounter m_allocs;
+    TelemetryCounter m_deallocs;
+    TelemetryCounter m_peak_chunks;
+
+    TelemetryCounter m_blocks;
+    TelemetryCounter m_block_bytes;
+    TelemetryCounter m_carved_chunks;
+#endif  // POOL_TELEMETRY
+
+#ifdef POOL_TELEMETRY_EVENTS
+    uintptr_t m_pool;
+    // rings are large, pools are not
+    std::unique_ptr<EventRing> m_ring;
+#endif  // POOL_TELEMETRY_EVENTS
+};
+
+};  // namespace X17
+
+#endif  // !X17_POOL_TELEMETRY
@@ -0,0 +1,122 @@
+////////////////////////////////////////////////////////////
+/// Headers
+////////////////////////////////////////////////////////////
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include "../../../include/X17Vector.hpp"
+#include "recycling_pool.hpp"
+
+/* request objects owning buffers, taken from a raw MemPool (constructed
+ * and destroyed for every request) and from a RecyclingPool (reset and
+ * reused with the capacity of their buffers):
+ *
+ *     g++ -std=c++17 -O2 recycling_bench.cpp -o recycling_bench
+ *     ./recycling_bench [requests] [body bytes]
+ */
+
+using namespace X17;
+
+static const size_t BENCH_REQUESTS = 1 << 18;
+static const size_t BENCH_BODY_BYTES = 2048;
+// a header offset per this many body bytes
+static const size_t BENCH_HEADER_STRIDE = 32;
+// requests in flight at once
+static const size_t BENCH_IN_FLIGHT = 16;
+
+struct Request {
+    vector<uint8_t> m_body;
+    vector<uint64_t> m_header_offsets;
+    uint64_t m_id{0};
+
+    void reset() {
+        m_body.clear();
+        m_header_offsets.clear();
+        m_id = 0;
+    }
+};
+
+uint64_t fillRequest(Request& request, const uint64_t id, const size_t n_body_bytes) {
+    request.m_id = id;
+
+    for (size_t byte_idx = 0; byte_idx < n_body_bytes; ++byte_idx) {
+        request.m_body.push_back((uint8_t)(id + byte_idx));
+
+        if (byte_idx % BENCH_HEADER_STRIDE == 0) {
+            request.m_header_offsets.push_back(byte_idx);
+        }
+    }
+
+    return request.m_body[n_body_bytes - 1] + request.m_header_offsets.size();
+}
+
+/* nanoseconds per request */
+double benchRawPool(const size_t n_requests, const size_t n_body_bytes, uint64_t& checksum) {
+    MemPool<Request> pool;
+    Request* in_flight[BENCH_IN_FLIGHT];
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t request_idx = 0; request_idx < n_requests; request_idx += BENCH_IN_FLIGHT) {
+        for (Request*& request : in_flight) {
+            request = new (pool.allocate()) Request();
+            checksum += fillRequest(*request, request_idx, n_body_bytes);
+        }
+
+        for (Request* request : in_flight) {
+            request->~Request();
+            pool.deallocate(request);
+        }
+    }
+
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start)
+               .count() /
+           n_requests;
+}
+
+double benchRecyclingPool(const size_t n_requests, const size_t n_body_bytes,
+                          uint64_t& checksum) {
+    RecyclingPool<Request> pool(BENCH_IN_FLIGHT);
+    RecyclingPool<Request>::Handle in_flight[BENCH_IN_FLIGHT];
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t request_idx = 0; request_idx < n_requests; request_idx += BENCH_IN_FLIGHT) {
+        for (RecyclingPool<Request>::Handle& request : in_flight) {
+            request = pool.acquire();
+            checksum += fillRequest(*request, request_idx, n_body_bytes);
+        }
+
+        for (RecyclingPool<Request>::Handle& request : in_flight) {
+            request.reset();
+        }
+    }
+
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start)
+               .count() /
+           n_requests;
+}
+
+int main(int argc, char* argv[]) {
+    size_t n_requests = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : BENCH_REQUESTS;
+    size_t n_body_bytes = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : BENCH_BODY_BYTES;
+
+    uint64_t raw_checksum = 0;
+    uint64_t recycled_checksum = 0;
+
+    double raw_ns = benchRawPool(n_requests, n_body_bytes, raw_checksum);
+    double recycled_ns = benchRecyclingPool(n_requests, n_body_bytes, recycled_checksum);
+
+    printf("%zu requests of %zu body bytes, ns per request\n", n_requests, n_body_bytes);
+    printf("%-16s %12.1f\n", "MemPool", raw_ns);
+    printf("%-16s %12.1f\n", "RecyclingPool", recycled_ns);
+
+    // both served the same requests
+    if (raw_checksum != recycled_checksum) {
+        printf("  checksums differ\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,191 @@
+#ifndef X17_RECYCLING_POOL
+#define X17_RECYCLING_POOL
+
+////////////////////////////////////////////////////////////
+/// Headers
+////////////////////////////////////////////////////////////
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "pool_alloc_stl.hpp"
+
+namespace X17 {
+
+// live objects a RecyclingPool keeps unless it is told otherwise
+static const std::size_t DEFAULT_RECYCLE_RETAINED = 256;
+
+/* default reset hook of RecyclingPool, calls T::reset(). The hook puts an
+ * object back into its freshly constructed state but keeps what is
+ * expensive to make again, e.g. clear() on its buffers instead of freeing
+ * them */
+template <typename T>
+struct MemberReset {
+    void operator()(T& object) const { object.reset(); }
+};
+
+/* typed pool of constructed objects over a MemPool. A released object is
+ * reset and kept alive for the next acquire(), so reuse pays neither its
+ * constructor and destructor nor the allocations of its members. Only up to
+ * max_retained objects are kept, further ones are destroyed and their chunk
+ * goes back to the MemPool. Like MemPool, one thread at a time */
+template <typename T, typename Reset = MemberReset<T>,
+          std::size_t chunksPerBlock = DEFAULT_CHUNKS_PER_BLOCK>
+class RecyclingPool {
+   public:
+    /* owns an acquired object and gives it back to the pool when it dies,
+     * like std::unique_ptr */
+    class Handle {
+       public:
+        Handle() = default;
+
+        Handle(Handle&& other) noexcept
+            : m_pool(other.m_pool), m_object(other.m_object) {
+            other.m_object = nullptr;
+        }
+
+        Handle& operator=(Handle&& other) noexcept {
+            if (this != &other) {
+                reset();
+
+                m_pool = other.m_pool;
+                m_object = other.m_object;
+                other.m_object = nullptr;
+            }
+
+            return *this;
+        }
+
+        /* ONE OWNER PER OBJECT, COPY IS PROHIBITED */
+        Handle(const Handle& other) = delete;
+        Handle& operator=(const Handle& other) = delete;
+
+        ~Handle() { reset(); }
+
+        T* get() const { return m_object; }
+        T& operator*() const { return *m_object; }
+        T* operator->() const { return m_object; }
+        explicit operator bool() const { return m_object != nullptr; }
+
+        /* gives the object back now */
+        void reset() {
+            if (m_object != nullptr) {
+                m_pool->recycle(m_object);
+                m_object = nullptr;
+            }
+        }
+
+        /* the caller owns the object and hands it to recycle() later */
+        T* release() {
+            T* object = m_object;
+            m_object = nullptr;
+            return object;
+        }
+
+       private:
+        friend class RecyclingPool;
+
+        Handle(RecyclingPool* pool, T* object) : m_pool(pool), m_object(object) {}
+
+        RecyclingPool* m_pool{nullptr};
+        T* m_object{nullptr};
+    };
+
+   public:
+    explicit RecyclingPool(const std::size_t max_retained = DEFAULT_RECYCLE_RETAINED,
+                           const Reset& reset = Reset())
+        : m_max_retained(max_retained), m_reset(reset) {
+        // recycle() never allocates
+        m_retained.reserve(max_retained);
+    }
+
+    ~RecyclingPool() { shrink(0); }
+
+    /* OBJECTS ARE OWNED BY THE POOL, COPY AND MOVE ARE PROHIBITED */
+    RecyclingPool(const RecyclingPool& other) = delete;
+    RecyclingPool& operator=(const RecyclingPool& other) = delete;
+
+    /* a retained object if there is one, otherwise one constructed from
+     * args */
+    template <typename... Args>
+    Handle acquire(Args&&... args) {
+        return Handle(this, acquireRaw(std::forward<Args>(args)...));
+    }
+
+    template <typename... Args>
+    T* acquireRaw(Args&&... args) {
+        if (!m_retained.empty()) {
+            T* object = m_retained.back();
+            m_retained.pop_back();
+
+            return object;
+        }
+
+        return construct(std::forward<Args>(args)...);
+    }
+
+    /* resets object and keeps it, or destroys it with the pool at its cap */
+    void recycle(T* object) {
+        if (object == nullptr) {
+            return;
+        }
+
+        if (m_retained.size() >= m_max_retained) {
+            destroy(object);
+            return;
+        }
+
+        m_reset(*object);
+        m_retained.push_back(object);
+    }
+
+    /* constructs objects up front, up to the cap */
+    template <typename... Args>
+    void preallocate(const std::size_t n_objects, Args&&... args) {
+        while (m_retained.size() < std::min(n_objects, m_max_retained)) {
+            m_retained.push_back(construct(args...));
+        }
+    }
+
+    /* destroys retained objects until keep are left */
+    void shrink(const std::size_t keep) {
+        while (m_retained.size() > keep) {
+            destroy(m_retained.back());
+            m_retained.pop_back();
+        }
+    }
+
+    std::size_t retained() const { return m_retained.size(); }
+    std::size_t maxRetained() const { return m_max_retained; }
+
+   private:
+    template <typename... Args>
+    T* construct(Args&&... args) {
+        T* chunk = m_pool.allocate();
+        try {
+            return new (chunk) T(std::forward<Args>(args)...);
+        } catch (...) {
+            m_pool.deallocate(chunk);
+            throw;
+        }
+    }
+
+    void destroy(T* object) {
+        object->~T();
+        m_pool.deallocate(object);
+    }
+
+   private:
+    MemPool<T, chunksPerBlock> m_pool;
+
+    std::vector<T*> m_retained;
+    std::size_t m_max_retained;
+
+    Reset m_reset;
+};
+
+};  // namespace X17
+
+#endif  // !X17_RECYCLING_POOL
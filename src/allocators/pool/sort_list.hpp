@@ -0,0 +1,67 @@
+#ifndef X17_SORT_LIST
+#define X17_SORT_LIST
+
+////////////////////////////////////////////////////////////
+/// Headers
+////////////////////////////////////////////////////////////
+#include <cstddef>
+#include <cstdint>
+
+namespace X17 {
+
+/* merges two address-ordered lists linked through Node::m_next */
+template <typename Node>
+Node* mergeByAddress(Node* left, Node* right) {
+    Node* head = nullptr;
+    Node** tail = &head;
+
+    while (left != nullptr && right != nullptr) {
+        if (reinterpret_cast<uintptr_t>(left) < reinterpret_cast<uintptr_t>(right)) {
+            *tail = left;
+            left = left->m_next;
+        } else {
+            *tail = right;
+            right = right->m_next;
+        }
+
+        tail = &(*tail)->m_next;
+    }
+
+    *tail = left != nullptr ? left : right;
+    return head;
+}
+
+/* bottom-up merge sort by node address, no recursion and no allocation: it
+ * runs inside the pools, which may be what malloc is */
+template <typename Node>
+Node* sortByAddress(Node* head) {
+    // runs[i] is a sorted run of 2^i nodes
+    Node* runs[64] = {};
+
+    while (head != nullptr) {
+        Node* run = head;
+        head = head->m_next;
+        run->m_next = nullptr;
+
+        size_t run_idx = 0;
+        for (; runs[run_idx] != nullptr; ++run_idx) {
+            run = mergeByAddress(runs[run_idx], run);
+            runs[run_idx] = nullptr;
+        }
+
+        runs[run_idx] = run;
+    }
+
+    Node* sorted = nullptr;
+    for (Node* run : runs) {
+        if (run != nullptr) {
+            sorted = mergeByAddress(run, sorted);
+        }
+    }
+
+    return sorted;
+}
+
+};  // namespace X17
+
+#endif  // !X17_SORT_LIST
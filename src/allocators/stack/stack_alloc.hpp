@@ -0,0 +1,298 @@
+#ifndef X17_STACK_ALLOC
+#define X17_STACK_ALLOC
+
+////////////////////////////////////////////////////////////
+/// Headers
+////////////////////////////////////////////////////////////
+#include <sys/mman.h>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <algorithm>
+#include <memory_resource>
+
+#include "../generic/generic_alloc.hpp"
+
+namespace X17 {
+
+// bytes per arena block unless the arena is told otherwise
+static const size_t DEFAULT_ARENA_BLOCK_SIZE = 64 * 1024;
+
+// where the arena gets its blocks from
+enum class ArenaBacking {
+    generic_heap,
+    os_pages,
+};
+
+/* bump-pointer (stack) allocator: allocation is a pointer increment, memory
+ * is given back all at once with release(mark) or when the arena dies */
+class Arena {
+    struct Block {
+        Block* m_prev;
+        size_t m_bytes;  // whole block including this header
+    };
+
+   public:
+    struct Marker {
+        Block* m_block;
+        uint8_t* m_top;
+    };
+
+   public:
+    explicit Arena(const size_t block_size = DEFAULT_ARENA_BLOCK_SIZE,
+                   const ArenaBacking backing = ArenaBacking::generic_heap)
+        : m_block_size(block_size), m_backing(backing) {}
+
+    ~Arena() {
+        release(Marker{nullptr, nullptr});
+
+        if (m_spare != nullptr) {
+            freeBlock(m_spare);
+        }
+    }
+
+    /* ARENAS OWN THEIR BLOCKS, COPY AND MOVE ARE PROHIBITED */
+    Arena(const Arena& other) = delete;
+    Arena(Arena&& other) = delete;
+    Arena& operator=(const Arena& other) = delete;
+    Arena& operator=(Arena&& other) = delete;
+
+   public:
+    void* allocate(const size_t n_bytes,
+                   const size_t alignment = alignof(std::max_align_t)) {
+        uint8_t* data = alignUp(m_top, alignment);
+
+        if (data + n_bytes > m_end || m_top == nullptr) {
+            pushBlock(n_bytes + alignment);
+            data = alignUp(m_top, alignment);
+        }
+
+        m_top = data + n_bytes;
+        return data;
+    }
+
+    /* only the most recent allocation can really be given back */
+    void deallocate(void* mem_ptr, const size_t n_bytes) {
+        if ((uint8_t*)mem_ptr + n_bytes == m_top) {
+            m_top = (uint8_t*)mem_ptr;
+        }
+    }
+
+    /* grows the most recent allocation in place */
+    bool tryExpand(void* mem_ptr, const size_t old_bytes, const size_t new_bytes) {
+        if ((uint8_t*)mem_ptr + old_bytes != m_top ||
+            (uint8_t*)mem_ptr + new_bytes > m_end) {
+            return false;
+        }
+
+        m_top = (uint8_t*)mem_ptr + new_bytes;
+        return true;
+    }
+
+    Marker mark() const { return Marker{m_block, m_top}; }
+
+    /* everything allocated after marker is gone */
+    void release(const Marker marker) {
+        while (m_block != marker.m_block) {
+            Block* released_block = m_block;
+            m_block = released_block->m_prev;
+
+            // one block is kept, so a loop around mark()/release() that
+            // crosses a block boundary does not map and unmap every time
+            if (m_spare == nullptr && released_block->m_bytes == blockBytes(0)) {
+                m_spare = released_block;
+            } else {
+                freeBlock(released_block);
+            }
+        }
+
+        m_top = marker.m_top;
+        m_end = m_block != nullptr ? (uint8_t*)m_block + m_block->m_bytes : nullptr;
+    }
+
+    void reset() { release(Marker{nullptr, nullptr}); }
+
+    /* arena used by default-constructed ArenaAllocators on this thread */
+    static Arena& current() {
+        if (m_current != nullptr) {
+            return *m_current;
+        }
+
+        static thread_local Arena thread_arena;
+        return thread_arena;
+    }
+
+   private:
+    static uint8_t* alignUp(uint8_t* address, const size_t alignment) {
+        return (uint8_t*)(((uintptr_t)address + alignment - 1) & ~(alignment - 1));
+    }
+
+    size_t blockBytes(const size_t n_bytes) const {
+        return std::max(m_block_size, n_bytes + sizeof(Block));
+    }
+
+    void pushBlock(const size_t n_bytes) {
+        Block* new_block = nullptr;
+
+        if (m_spare != nullptr && m_spare->m_bytes >= n_bytes + sizeof(Block)) {
+            new_block = m_spare;
+            m_spare = nullptr;
+        } else {
+            new_block = mapBlock(blockBytes(n_bytes));
+        }
+
+        new_block->m_prev = m_block;
+        m_block = new_block;
+
+        m_top = (uint8_t*)(new_block + 1);
+        m_end = (uint8_t*)new_block + new_block->m_bytes;
+    }
+
+    Block* mapBlock(const size_t block_bytes) {
+        void* memory = nullptr;
+
+        if (m_backing == ArenaBacking::os_pages) {
+            memory = mmap(nullptr, block_bytes, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            memory = memory == MAP_FAILED ? nullptr : memory;
+        } else {
+            memory = X17::allocate(block_bytes);
+        }
+
+        if (memory == nullptr) {
+            throw std::bad_alloc();
+        }
+
+        Block* new_block = reinterpret_cast<Block*>(memory);
+        new_block->m_bytes = block_bytes;
+
+        return new_block;
+    }
+
+    void freeBlock(Block* block) {
+        if (m_backing == ArenaBacking::os_pages) {
+            munmap(block, block->m_bytes);
+        } else {
+            X17::deallocate(reinterpret_cast<data_t*>(block));
+        }
+    }
+
+   private:
+    Block* m_block{nullptr};
+    Block* m_spare{nullptr};
+
+    uint8_t* m_top{nullptr};
+    uint8_t* m_end{nullptr};
+
+    size_t m_block_size;
+    ArenaBacking m_backing;
+
+    friend class ArenaScope;
+    inline static thread_local Arena* m_current = nullptr;
+};
+
+/* makes arena the current one for this thread and releases everything
+ * allocated from it when the scope ends (e.g. one request) */
+class ArenaScope {
+   public:
+    explicit ArenaScope(Arena& arena)
+        : m_arena(arena), m_marker(arena.mark()), m_outer(Arena::m_current) {
+        Arena::m_current = &arena;
+    }
+
+    ~ArenaScope() {
+        m_arena.release(m_marker);
+        Arena::m_current = m_outer;
+    }
+
+    ArenaScope(const ArenaScope& other) = delete;
+    ArenaScope& operator=(const ArenaScope& other) = delete;
+
+   private:
+    Arena& m_arena;
+    Arena::Marker m_marker;
+    Arena* m_outer;
+};
+
+/* STL-compatible adapter, usable as X17::vector<T, ArenaAllocator> */
+template <typename T>
+class ArenaAllocator {
+   public:
+    /* TYPEDEFS */
+    typedef T value_type;
+    typedef T* pointer;
+    typedef std::size_t size_type;
+    /* END OF TYPEDEFS */
+
+   public:
+    ArenaAllocator() : m_arena(&Arena::current()) {}
+
+    explicit ArenaAllocator(Arena& arena) : m_arena(&arena) {}
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : m_arena(other.m_arena) {}
+
+    pointer allocate(size_type cnt) {
+        return reinterpret_cast<pointer>(
+            m_arena->allocate(cnt * sizeof(T), alignof(T)));
+    }
+
+    pointer allocate_aligned(size_type cnt, size_type alignment) {
+        return reinterpret_cast<pointer>(m_arena->allocate(
+            cnt * sizeof(T), std::max(alignment, alignof(T))));
+    }
+
+    void deallocate(pointer ptr, size_type cnt) {
+        m_arena->deallocate(ptr, cnt * sizeof(T));
+    }
+
+    bool try_expand(pointer ptr, size_type old_cnt, size_type new_cnt) {
+        return m_arena->tryExpand(ptr, old_cnt * sizeof(T), new_cnt * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const {
+        return m_arena == other.m_arena;
+    }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const {
+        return m_arena != other.m_arena;
+    }
+
+   private:
+    template <typename U>
+    friend class ArenaAllocator;
+
+    Arena* m_arena;
+};
+
+/* std::pmr adapter: deallocation gives back only the most recent block, the
+ * rest goes with release() or reset() of the arena */
+class ArenaResource : public std::pmr::memory_resource {
+   public:
+    ArenaResource() : m_arena(&Arena::current()) {}
+
+    explicit ArenaResource(Arena& arena) : m_arena(&arena) {}
+
+   private:
+    void* do_allocate(size_t n_bytes, size_t alignment) override {
+        return m_arena->allocate(n_bytes, alignment);
+    }
+
+    void do_deallocate(void* mem_ptr, size_t n_bytes, size_t) override {
+        m_arena->deallocate(mem_ptr, n_bytes);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        const ArenaResource* other_arena = dynamic_cast<const ArenaResource*>(&other);
+        return other_arena != nullptr && other_arena->m_arena == m_arena;
+    }
+
+   private:
+    Arena* m_arena;
+};
+
+};  // namespace X17
+
+#endif  // !X17_STACK_ALLOC